@@ -0,0 +1,201 @@
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "common.h"
+
+/**
+ * Native replacement of checker.py. Checks that the output file contains a
+ * not decreasing sequence of numbers. When the input files are given too, it
+ * also checks that the output is a permutation of all the inputs using a
+ * multiset hash, so lost or duplicated numbers are caught as well.
+ *
+ * $> ./checker -f sorted.txt [test1.txt test2.txt ...]
+ *
+ * All the files are mmap-ed and streamed, nothing is loaded into the heap.
+ */
+
+typedef uint64_t u64;
+
+/**
+ * Additive multiset hash. It does not depend on the order of the numbers,
+ * so it is the same for the inputs and for the sorted output. Two
+ * independent sums make an accidental collision practically impossible.
+ */
+struct multiset_hash {
+    u64 count;
+    u64 sum1;
+    u64 sum2;
+};
+
+static inline u64
+mix64(u64 z) {
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+}
+
+static inline void
+multiset_hash_add(struct multiset_hash* h, long long value) {
+    h->count++;
+    h->sum1 += mix64((u64)value + 0x9e3779b97f4a7c15ull);
+    h->sum2 += mix64((u64)value ^ 0xd6e8feb86659fd93ull);
+}
+
+static b32
+multiset_hash_equal(const struct multiset_hash* a, const struct multiset_hash* b) {
+    return a->count == b->count && a->sum1 == b->sum1 && a->sum2 == b->sum2;
+}
+
+/* Mapped file */
+
+struct mapped_file {
+    u8* data;
+    isize len;
+};
+
+static struct mapped_file
+mapped_file_open(const char* filename) {
+    struct mapped_file m = {0};
+    int fd = open(filename, O_RDONLY);
+    if (fd == -1) {
+        handle_error();
+    }
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        handle_error();
+    }
+    m.len = st.st_size;
+    /* mmap() does not accept empty mappings. */
+    if (m.len > 0) {
+        m.data = mmap(NULL, m.len, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (m.data == MAP_FAILED) {
+            handle_error();
+        }
+        madvise(m.data, m.len, MADV_SEQUENTIAL);
+    }
+    close(fd);
+    return m;
+}
+
+static void
+mapped_file_close(struct mapped_file* m) {
+    if (m->len > 0) {
+        munmap(m->data, m->len);
+    }
+    *m = (struct mapped_file){0};
+}
+
+/* Streaming number scanner */
+
+struct scanner {
+    const u8* at;
+    const u8* end;
+};
+
+static inline b32
+is_space(u8 c) {
+    return c == ' ' || c == '\n' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+}
+
+/**
+ * Fetch the next number. Returns 0 on the end of data. Garbage between the
+ * numbers is skipped like checker.py does.
+ */
+static inline b32
+scanner_next(struct scanner* s, long long* out) {
+    for (;;) {
+        while (s->at < s->end && is_space(*s->at)) {
+            s->at++;
+        }
+        if (s->at == s->end) {
+            return 0;
+        }
+        const u8* begin = s->at;
+        b32 negative = 0;
+        if (*s->at == '-' || *s->at == '+') {
+            negative = *s->at == '-';
+            s->at++;
+        }
+        long long value = 0;
+        const u8* digits = s->at;
+        b32 overflow = 0;
+        while (s->at < s->end && *s->at >= '0' && *s->at <= '9') {
+            int digit = *s->at - '0';
+            if (value > (LLONG_MAX - digit) / 10) {
+                overflow = 1;
+                break;
+            }
+            value = value * 10 + digit;
+            s->at++;
+        }
+        if (!overflow && s->at != digits && (s->at == s->end || is_space(*s->at))) {
+            *out = negative ? -value : value;
+            return 1;
+        }
+        /* Not a number - skip the whole word. */
+        s->at = begin;
+        while (s->at < s->end && !is_space(*s->at)) {
+            s->at++;
+        }
+    }
+}
+
+static struct multiset_hash
+hash_file(const char* filename) {
+    struct multiset_hash h = {0};
+    struct mapped_file m = mapped_file_open(filename);
+    struct scanner s = {m.data, m.data + m.len};
+    long long value;
+    while (scanner_next(&s, &value)) {
+        multiset_hash_add(&h, value);
+    }
+    mapped_file_close(&m);
+    return h;
+}
+
+static void
+usage(const char* exe) {
+    printf("Usage: %s -f <sorted file> [input files...]\n", exe);
+    exit(1);
+}
+
+int
+main(int argc, char** argv) {
+    if (argc < 3 || strcmp(argv[1], "-f") != 0) {
+        usage(argv[0]);
+    }
+
+    struct multiset_hash output_hash = {0};
+    struct mapped_file m = mapped_file_open(argv[2]);
+    struct scanner s = {m.data, m.data + m.len};
+    long long prev = LLONG_MIN;
+    long long value;
+    while (scanner_next(&s, &value)) {
+        if (value < prev) {
+            printf("Error on numbers %lld %lld\n", prev, value);
+            return 1;
+        }
+        prev = value;
+        multiset_hash_add(&output_hash, value);
+    }
+    mapped_file_close(&m);
+
+    if (argc > 3) {
+        struct multiset_hash input_hash = {0};
+        for (int i = 3; i < argc; i++) {
+            struct multiset_hash h = hash_file(argv[i]);
+            input_hash.count += h.count;
+            input_hash.sum1 += h.sum1;
+            input_hash.sum2 += h.sum2;
+        }
+        if (!multiset_hash_equal(&input_hash, &output_hash)) {
+            printf("Error: output is not a permutation of the input, %llu numbers in input, %llu in output\n",
+                   (unsigned long long)input_hash.count, (unsigned long long)output_hash.count);
+            return 1;
+        }
+    }
+
+    printf("All is ok\n");
+    return 0;
+}
@@ -0,0 +1,166 @@
+#include <fcntl.h>
+#include <limits.h>
+#include <time.h>
+#include "common.h"
+
+/**
+ * Native replacement of generator.py. Writes random non-negative numbers
+ * separated by spaces. Usage is the same:
+ *
+ * $> ./generator -f test1.txt -c 10000 -m 10000 [-s seed]
+ */
+
+typedef uint64_t u64;
+
+enum {
+    GENERATOR_BUFFER_SIZE = 1 << 20,
+    /* Longest number is 2^31 which has 10 digits, plus the separator. */
+    GENERATOR_MAX_NUMBER_LEN = 16,
+};
+
+/* PRNG: xoshiro256** seeded via splitmix64 */
+
+struct rng {
+    u64 s[4];
+};
+
+static u64
+splitmix64(u64* state) {
+    u64 z = (*state += 0x9e3779b97f4a7c15ull);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+}
+
+static void
+rng_seed(struct rng* r, u64 seed) {
+    for (int i = 0; i < countof(r->s); i++) {
+        r->s[i] = splitmix64(&seed);
+    }
+}
+
+static inline u64
+rotl(u64 x, int k) {
+    return (x << k) | (x >> (64 - k));
+}
+
+static inline u64
+rng_next(struct rng* r) {
+    u64* s = r->s;
+    u64 result = rotl(s[1] * 5, 7) * 9;
+    u64 t = s[1] << 17;
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = rotl(s[3], 45);
+    return result;
+}
+
+/** Uniform number in [0, bound). Lemire's multiply-shift, bias is negligible for 32-bit bounds. */
+static inline u64
+rng_below(struct rng* r, u64 bound) {
+    return (u64)(((unsigned __int128)rng_next(r) * bound) >> 64);
+}
+
+/* Output */
+
+static inline isize
+format_u64(u8* out, u64 value) {
+    u8 tmp[24];
+    isize n = 0;
+    do {
+        tmp[n++] = '0' + value % 10;
+        value /= 10;
+    } while (value != 0);
+    for (isize i = 0; i < n; i++) {
+        out[i] = tmp[n - 1 - i];
+    }
+    return n;
+}
+
+struct options {
+    const char* filename;
+    long long count;
+    long long max;
+    u64 seed;
+};
+
+static void
+usage(const char* exe) {
+    printf("Usage: %s -f <file name> -c <number count> [-m <maximal number>] [-s <seed>]\n", exe);
+    exit(1);
+}
+
+static struct options
+parse_options(int argc, char** argv) {
+    struct options o = {0};
+    o.count = -1;
+    o.max = 1ll << 31;
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    o.seed = (u64)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+
+    for (int i = 1; i < argc; i++) {
+        if (i + 1 == argc) {
+            usage(argv[0]);
+        }
+        const char* value = argv[++i];
+        if (strcmp(argv[i - 1], "-f") == 0) {
+            o.filename = value;
+        } else if (strcmp(argv[i - 1], "-c") == 0) {
+            o.count = atoll(value);
+        } else if (strcmp(argv[i - 1], "-m") == 0) {
+            o.max = atoll(value);
+        } else if (strcmp(argv[i - 1], "-s") == 0) {
+            o.seed = strtoull(value, NULL, 10);
+        } else {
+            usage(argv[0]);
+        }
+    }
+    if (o.filename == NULL || o.count < 0 || o.max < 0 || o.max > (1ll << 31)) {
+        usage(argv[0]);
+    }
+    return o;
+}
+
+int
+main(int argc, char** argv) {
+    struct options o = parse_options(argc, argv);
+
+    int fd = open(o.filename, O_CREAT | O_WRONLY | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+    if (fd == -1) {
+        handle_error();
+    }
+
+    struct rng rng;
+    rng_seed(&rng, o.seed);
+
+    struct u8_buffer b = {0};
+    b.data = malloc(GENERATOR_BUFFER_SIZE);
+    if (b.data == NULL) {
+        handle_error();
+    }
+    b.cap = GENERATOR_BUFFER_SIZE;
+
+    /* Same as random.randint(0, max) - both ends are included. */
+    u64 bound = (u64)o.max + 1;
+    for (long long i = 0; i < o.count; i++) {
+        if (b.cap - b.len < GENERATOR_MAX_NUMBER_LEN) {
+            u8_buffer_write_fd(&b, fd);
+            u8_buffer_clear(&b);
+        }
+        if (i > 0) {
+            b.data[b.len++] = ' ';
+        }
+        b.len += format_u64(&b.data[b.len], rng_below(&rng, bound));
+    }
+    u8_buffer_write_fd(&b, fd);
+
+    free(b.data);
+    if (close(fd) == -1) {
+        handle_error();
+    }
+    return 0;
+}
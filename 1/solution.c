@@ -1,16 +1,19 @@
 #include <ctype.h>
 #include <limits.h>
 #include <fcntl.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "libcoro.h"
 #include "common.h"
 
 /**
  * You can compile and run this code using the commands:
  *
- * $> gcc solution.c libcoro.c
+ * $> gcc solution.c libcoro.c -lpthread
  * $> ./a.out
  */
 
@@ -32,6 +35,38 @@ struct parse_result {
     b32 error;
 };
 
+/**
+ * Parse one number at @a begin, not looking further than @a end. The input
+ * is not zero-terminated when it is mmap-ed or is a chunk of a bigger buffer,
+ * so strtol() can't be used here. Returns the parsed length, 0 if there is no
+ * number.
+ */
+static inline isize
+parse_int(const u8* begin, const u8* end, int* out) {
+    const u8* at = begin;
+    b32 is_negative = 0;
+    if (at < end && (*at == '-' || *at == '+')) {
+        is_negative = *at == '-';
+        at++;
+    }
+    const u8* digits = at;
+    long value = 0;
+    while (at < end && isdigit(*at)) {
+        value = value * 10 + (*at - '0');
+        assert(value <= (long)INT_MAX + 1);
+        at++;
+    }
+    if (at == digits) {
+        return 0;
+    }
+    if (is_negative) {
+        value = -value;
+    }
+    assert(value <= (long)INT_MAX);
+    *out = value;
+    return at - begin;
+}
+
 struct parse_result
 parse(struct u8_buffer* b, struct integers* ints) {
     struct parse_result r = {0};
@@ -43,21 +78,185 @@ parse(struct u8_buffer* b, struct integers* ints) {
             continue;
         }
 
-        if (isdigit(b->data[i])) {
-            char* begin = (char*)&b->data[i];
-            char* end = (char*)begin;
-            long value = strtol(begin, &end, 10);
-            assert(value >= (long)INT_MIN && value <= (long)INT_MAX);
-            isize count = end - begin;
-            if (!count) {
-                r.error = 1;
-                r.location = i;
-                break;
+        int value;
+        isize count = parse_int(&b->data[i], &b->data[b->len], &value);
+        if (!count) {
+            r.error = 1;
+            r.location = i;
+            break;
+        }
+        i += count;
+        *push(ints) = value;
+    }
+    return r;
+}
+
+/* Parallel parsing of a single big file */
+
+enum {
+    /** Files smaller than that are not worth spawning threads for. */
+    PARALLEL_PARSE_MIN_CHUNK_SIZE = 256 * 1024,
+};
+
+/**
+ * Parse threads, shared by all the coroutines. The counters are changed only
+ * by the coroutines, which all run in the main thread. Only the finish
+ * notifications come from the parse threads, under the mutex.
+ */
+static struct {
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    /** Parse threads which can be running at once, over all the files. */
+    isize thread_limit;
+    /** Parse threads which are running or not joined yet. */
+    isize thread_count;
+    /** Coroutines which are not finished yet. */
+    isize coro_count;
+    /** Coroutines which wait for their parse threads. */
+    isize waiting_count;
+    /** Parse threads ever finished. Protected by the mutex. */
+    isize finished_total;
+} parse_threads = {
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+    .cond = PTHREAD_COND_INITIALIZER,
+};
+
+struct parse_chunk {
+    struct u8_buffer data;
+    struct integers ints;
+    struct parse_result result;
+    pthread_t thread;
+    /** Finished threads of the same file. Protected by the mutex. */
+    isize* finished_count;
+};
+
+/** Same as parse() but without yields - it is executed in a separate thread. */
+static void*
+parse_chunk_f(void* arg) {
+    struct parse_chunk* chunk = arg;
+    struct u8_buffer* b = &chunk->data;
+    struct integers* ints = &chunk->ints;
+    /* About 2 bytes per number at least, let it grow from a good guess. */
+    ints->cap = b->len / 4 + 1;
+    ints->data = reallocarray(NULL, ints->cap, sizeof(*ints->data));
+    if (ints->data == NULL) {
+        handle_error();
+    }
+    for (isize i = 0; i < b->len;) {
+        if (isspace(b->data[i])) {
+            i++;
+            continue;
+        }
+        int value;
+        isize count = parse_int(&b->data[i], &b->data[b->len], &value);
+        if (!count) {
+            chunk->result.error = 1;
+            chunk->result.location = i;
+            break;
+        }
+        i += count;
+        *push(ints) = value;
+    }
+    pthread_mutex_lock(&parse_threads.mutex);
+    ++*chunk->finished_count;
+    ++parse_threads.finished_total;
+    pthread_cond_broadcast(&parse_threads.cond);
+    pthread_mutex_unlock(&parse_threads.mutex);
+    return NULL;
+}
+
+/**
+ * Split @a b into up to @a max_chunks parts at whitespace boundaries, parse
+ * them in parallel threads into own slices, and concatenate the slices into
+ * @a ints. The threads are taken from the budget shared by all the coroutines,
+ * so several big files don't start a thread per core each. While the threads
+ * work, the calling coroutine yields to the others. When all the coroutines
+ * are waiting for their threads, it sleeps until any of the threads finishes.
+ */
+static struct parse_result
+parse_parallel(struct u8_buffer* b, struct integers* ints, isize max_chunks) {
+    struct parse_result r = {0};
+    isize chunk_count = b->len / PARALLEL_PARSE_MIN_CHUNK_SIZE;
+    if (chunk_count > max_chunks) {
+        chunk_count = max_chunks;
+    }
+    isize free_threads = parse_threads.thread_limit - parse_threads.thread_count;
+    if (chunk_count > free_threads) {
+        chunk_count = free_threads;
+    }
+    if (chunk_count <= 1) {
+        return parse(b, ints);
+    }
+
+    struct parse_chunk* chunks = calloc(chunk_count, sizeof(*chunks));
+    if (chunks == NULL) {
+        handle_error();
+    }
+    isize finished_count = 0;
+    isize begin = 0;
+    isize started = 0;
+    for (isize i = 0; i < chunk_count && begin < b->len; i++) {
+        isize end = i + 1 == chunk_count ? b->len : b->len / chunk_count * (i + 1);
+        if (end < begin) {
+            end = begin;
+        }
+        /* Move the border to a whitespace so as not to cut a number. */
+        while (end < b->len && !isspace(b->data[end])) {
+            end++;
+        }
+        struct parse_chunk* chunk = &chunks[started++];
+        chunk->data = (struct u8_buffer){&b->data[begin], end - begin, end - begin};
+        chunk->finished_count = &finished_count;
+        if (pthread_create(&chunk->thread, NULL, parse_chunk_f, chunk) != 0) {
+            handle_error();
+        }
+        begin = end;
+    }
+    parse_threads.thread_count += started;
+
+    parse_threads.waiting_count++;
+    pthread_mutex_lock(&parse_threads.mutex);
+    while (finished_count < started) {
+        if (parse_threads.waiting_count == parse_threads.coro_count) {
+            /* Nobody can run - sleep until some thread finishes. */
+            isize finished_total = parse_threads.finished_total;
+            while (parse_threads.finished_total == finished_total) {
+                pthread_cond_wait(&parse_threads.cond, &parse_threads.mutex);
             }
-            i += count;
-            *push(ints) = value;
         }
+        /* Let the others work or check their own threads. */
+        pthread_mutex_unlock(&parse_threads.mutex);
+        coro_yield();
+        pthread_mutex_lock(&parse_threads.mutex);
+    }
+    pthread_mutex_unlock(&parse_threads.mutex);
+    parse_threads.waiting_count--;
+
+    isize total_len = ints->len;
+    for (isize i = 0; i < started; i++) {
+        pthread_join(chunks[i].thread, NULL);
+        total_len += chunks[i].ints.len;
+    }
+    parse_threads.thread_count -= started;
+    if (ints->cap < total_len) {
+        void* data = reallocarray(ints->data, total_len, sizeof(*ints->data));
+        if (data == NULL) {
+            handle_error();
+        }
+        ints->data = data;
+        ints->cap = total_len;
     }
+    for (isize i = 0; i < started; i++) {
+        struct parse_chunk* chunk = &chunks[i];
+        if (chunk->result.error && !r.error) {
+            r.error = 1;
+            r.location = chunk->data.data - b->data + chunk->result.location;
+        }
+        memcpy(&ints->data[ints->len], chunk->ints.data, chunk->ints.len * sizeof(*ints->data));
+        ints->len += chunk->ints.len;
+        free(chunk->ints.data);
+    }
+    free(chunks);
     return r;
 }
 
@@ -215,23 +414,37 @@ coroutine_func_f(void *context)
 	struct u8_buffer content = {0};
 	{
 		int fd = open(filename, O_RDONLY);
-		struct read_result r = u8_buffer_read_fd_until_eof(&content, fd);
-		if (r.error) {
+		if (fd == -1) {
+			handle_error();
+		}
+		struct stat st;
+		if (fstat(fd, &st) == -1) {
 			handle_error();
 		}
-		assert(r.eof);
+		content.len = content.cap = st.st_size;
+		/* mmap() does not accept empty mappings. */
+		if (content.len > 0) {
+			content.data = mmap(NULL, content.len, PROT_READ, MAP_PRIVATE, fd, 0);
+			if (content.data == MAP_FAILED) {
+				handle_error();
+			}
+		}
 		close(fd);
 	}
 
-	struct parse_result r = parse(&content, ctx->ints);
+	/* Big files are parsed by the free cores, small ones - right here. */
+	struct parse_result r = parse_parallel(&content, ctx->ints, parse_threads.thread_limit);
 	printf("%s: switch count %lld\n", name, coro_switch_count(this));
 	assert(!r.error);
 
 	sort_integers_using_mergesort(ctx->ints);
 	printf("%s: switch count %lld\n", name, coro_switch_count(this));
 
-	free(content.data);
+	if (content.len > 0) {
+		munmap(content.data, content.len);
+	}
 	my_context_delete(ctx);
+	parse_threads.coro_count--;
 	/* This will be returned from coro_status(). */
 	return 0;
 }
@@ -250,6 +463,10 @@ main(int argc, char **argv)
 		*push((&integer_buffers)) = (struct integers){ 0 };
 	}
 
+	isize cpu_count = sysconf(_SC_NPROCESSORS_ONLN);
+	parse_threads.thread_limit = cpu_count > 0 ? cpu_count : 1;
+	parse_threads.coro_count = argc - 1;
+
 	/* Initialize our coroutine global cooperative scheduler. */
 	coro_sched_init();
 	/* Start several coroutines. */
@@ -0,0 +1,17 @@
+#!/bin/sh
+# Compare the fork() and posix_spawn() launchers of the shell on many short
+# pipelines. Usage: ./bench_launcher.sh [line count]
+
+count=${1:-10000}
+script=$(mktemp)
+trap 'rm -f "$script"' EXIT
+# Full paths - plain 'true' is a builtin and would not be exec-ed at all.
+yes '/bin/true | /bin/true' | head -n "$count" > "$script"
+
+for launcher in fork spawn; do
+	start=$(date +%s%N)
+	./solution -l "$launcher" < "$script" || exit 1
+	end=$(date +%s%N)
+	ms=$(( (end - start) / 1000000 ))
+	echo "$launcher: $count lines in $ms ms, $(( count * 1000 / (ms + 1) )) lines/sec"
+done
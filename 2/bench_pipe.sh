@@ -0,0 +1,16 @@
+#!/bin/sh
+# Throughput of a 'cat | cat | cat' chain in the shell: the builtin cat which
+# moves data with splice() versus /bin/cat. Usage: ./bench_pipe.sh [size in MB]
+
+size_mb=${1:-1024}
+data=$(mktemp)
+trap 'rm -f "$data"' EXIT
+head -c "$((size_mb * 1024 * 1024))" /dev/zero > "$data"
+
+for cat in cat /bin/cat; do
+	start=$(date +%s%N)
+	echo "$cat $data | $cat | $cat > /dev/null" | ./solution || exit 1
+	end=$(date +%s%N)
+	ms=$(( (end - start) / 1000000 ))
+	echo "$cat: $size_mb MB in $ms ms, $(( size_mb * 1000 / (ms + 1) )) MB/sec"
+done
@@ -2,14 +2,13 @@
 
 #include <assert.h>
 #include <ctype.h>
+#include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
 
-struct parser {
-	char *buffer;
-	uint32_t size;
-	uint32_t capacity;
-};
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 enum token_type {
 	TOKEN_TYPE_NONE,
@@ -23,49 +22,238 @@ enum token_type {
 	TOKEN_TYPE_BACKGROUND,
 };
 
+/**
+ * All the memory of one command line - the line itself, its expressions,
+ * strings and argument arrays - is taken from a chain of chunks. The whole
+ * line is freed at once by dropping the chunks.
+ */
+enum {
+	ARENA_CHUNK_SIZE = 1024,
+	ARENA_ALIGN = sizeof(void *),
+};
+
+struct arena_chunk {
+	struct arena_chunk *next;
+	uint32_t size;
+	uint32_t used;
+	char data[];
+};
+
+struct line_arena {
+	/** The first chunk is the one with free space. */
+	struct arena_chunk *chunks;
+	struct command_line line;
+};
+
+static inline uint32_t
+arena_align(uint32_t size)
+{
+	return (size + ARENA_ALIGN - 1) & ~(uint32_t)(ARENA_ALIGN - 1);
+}
+
+static struct arena_chunk *
+arena_chunk_new(uint32_t size)
+{
+	struct arena_chunk *c = malloc(sizeof(*c) + size);
+	c->next = NULL;
+	c->size = size;
+	c->used = 0;
+	return c;
+}
+
+static void *
+arena_alloc(struct line_arena *a, uint32_t size)
+{
+	size = arena_align(size);
+	struct arena_chunk *c = a->chunks;
+	if (c->size - c->used < size) {
+		if (size > ARENA_CHUNK_SIZE / 4) {
+			/*
+			 * Big allocations get an own chunk behind the
+			 * current one, so its free space is not wasted.
+			 */
+			struct arena_chunk *big = arena_chunk_new(size);
+			big->used = size;
+			big->next = c->next;
+			c->next = big;
+			return big->data;
+		}
+		c = arena_chunk_new(ARENA_CHUNK_SIZE);
+		c->next = a->chunks;
+		a->chunks = c;
+	}
+	void *res = c->data + c->used;
+	c->used += size;
+	return res;
+}
+
+static void *
+arena_calloc(struct line_arena *a, uint32_t size)
+{
+	void *res = arena_alloc(a, size);
+	memset(res, 0, size);
+	return res;
+}
+
+/**
+ * Grow the last allocation in place when possible. Otherwise a new piece
+ * is allocated and the old one is left to die with the whole arena.
+ */
+static void *
+arena_realloc(struct line_arena *a, void *ptr, uint32_t old_size,
+	      uint32_t new_size)
+{
+	struct arena_chunk *c = a->chunks;
+	old_size = arena_align(old_size);
+	if (ptr != NULL && (char *)ptr + old_size == c->data + c->used &&
+	    c->used - old_size + arena_align(new_size) <= c->size) {
+		c->used = c->used - old_size + arena_align(new_size);
+		return ptr;
+	}
+	void *res = arena_alloc(a, new_size);
+	if (ptr != NULL)
+		memcpy(res, ptr, old_size);
+	return res;
+}
+
+static struct line_arena *
+command_line_arena(struct command_line *line)
+{
+	return (struct line_arena *)((char *)line -
+		offsetof(struct line_arena, line));
+}
+
+static struct command_line *
+command_line_new(void)
+{
+	struct arena_chunk *c = arena_chunk_new(ARENA_CHUNK_SIZE);
+	struct line_arena *a = (struct line_arena *)c->data;
+	c->used = arena_align(sizeof(*a));
+	a->chunks = c;
+	memset(&a->line, 0, sizeof(a->line));
+	return &a->line;
+}
+
 struct token {
 	enum token_type type;
-	char *data;
+	/**
+	 * Token bytes. Points right into the parser buffer while the token
+	 * is a contiguous unchanged piece of it. Otherwise, when quotes or
+	 * escapes cut the source, it points at the own copy in @a buf.
+	 */
+	const char *data;
 	uint32_t size;
+	/** Own memory, used only when the source can't be referenced. */
+	char *buf;
 	uint32_t capacity;
 };
 
 static char *
-token_strdup(const struct token *t)
+token_strdup(struct line_arena *a, const struct token *t)
 {
 	assert(t->type == TOKEN_TYPE_STR);
 	assert(t->size > 0);
-	char *res = malloc(t->size + 1);
+	char *res = arena_alloc(a, t->size + 1);
 	memcpy(res, t->data, t->size);
 	res[t->size] = 0;
 	return res;
 }
 
 static void
-token_append(struct token *t, char c)
+token_reserve(struct token *t, uint32_t size)
+{
+	if (size <= t->capacity)
+		return;
+	uint32_t new_capacity = (t->capacity + 1) * 2;
+	if (new_capacity < size)
+		new_capacity = size;
+	t->buf = realloc(t->buf, sizeof(*t->buf) * new_capacity);
+	t->capacity = new_capacity;
+}
+
+/**
+ * Add @a len source bytes starting at @a pos to the token. While the bytes
+ * go one after another in the source, the token just grows as a slice of
+ * it. The bytes are copied only when the source has a gap, such as a quote
+ * or an escaping backslash.
+ */
+static void
+token_append(struct token *t, const char *pos, uint32_t len)
 {
-	if (t->size == t->capacity) {
-		t->capacity = (t->capacity + 1) * 2;
-		t->data = realloc(t->data, sizeof(*t->data) * t->capacity);
+	if (t->size == 0) {
+		t->data = pos;
+		t->size = len;
+		return;
+	}
+	if (t->data != t->buf) {
+		if (t->data + t->size == pos) {
+			t->size += len;
+			return;
+		}
+		token_reserve(t, t->size + len);
+		memcpy(t->buf, t->data, t->size);
+		t->data = t->buf;
 	} else {
-		assert(t->size < t->capacity);
+		token_reserve(t, t->size + len);
+		t->data = t->buf;
 	}
-	t->data[t->size++] = c;
+	memcpy(t->buf + t->size, pos, len);
+	t->size += len;
 }
 
 static void
 token_reset(struct token *t)
 {
 	t->size = 0;
+	t->data = NULL;
 	t->type = TOKEN_TYPE_NONE;
 }
 
+/** What the parser expects next in the current line. */
+enum parser_state {
+	/** Commands and operators between them. */
+	PARSER_STATE_EXPR,
+	/** An output redirect is met, the file name is expected. */
+	PARSER_STATE_OUT_FILE,
+	/** After the out file only '&' or the line end are allowed. */
+	PARSER_STATE_OUT_FILE_DONE,
+	/** After '&' only the line end is allowed. */
+	PARSER_STATE_BACKGROUND,
+	/** The line is broken, it is skipped until its end. */
+	PARSER_STATE_SKIP_LINE,
+};
+
+struct parser {
+	char *buffer;
+	/** Start of the not consumed data in the buffer. */
+	uint32_t offset;
+	uint32_t size;
+	uint32_t capacity;
+	/**
+	 * The line being parsed is kept between the calls together with
+	 * the position of the first not parsed token. So when the line is
+	 * not complete yet, the next parser_pop_next() continues from
+	 * where the previous one has stopped instead of rescanning the
+	 * whole line. Only the last incomplete token is parsed again.
+	 */
+	uint32_t pos;
+	struct command_line *line;
+	enum parser_state state;
+	/** Error to return when the skipped broken line ends. */
+	enum parser_error error;
+	/** The token is reused to keep its memory between lines. */
+	struct token token;
+};
+
 static void
-command_append_arg(struct command *cmd, char *arg)
+command_append_arg(struct line_arena *a, struct command *cmd, char *arg)
 {
 	if (cmd->arg_count == cmd->arg_capacity) {
+		uint32_t old_capacity = cmd->arg_capacity;
 		cmd->arg_capacity = (cmd->arg_capacity + 1) * 2;
-		cmd->args = realloc(cmd->args, sizeof(*cmd->args) * cmd->arg_capacity);
+		cmd->args = arena_realloc(a, cmd->args,
+			sizeof(*cmd->args) * old_capacity,
+			sizeof(*cmd->args) * cmd->arg_capacity);
 	} else {
 		assert(cmd->arg_count < cmd->arg_capacity);
 	}
@@ -75,20 +263,12 @@ command_append_arg(struct command *cmd, char *arg)
 void
 command_line_delete(struct command_line *line)
 {
-	while (line->head != NULL) {
-		struct expr *e = line->head;
-		if (e->type == EXPR_TYPE_COMMAND) {
-			struct command *cmd = &e->cmd;
-			free(cmd->exe);
-			for (uint32_t i = 0; i < cmd->arg_count; ++i)
-				free(cmd->args[i]);
-			free(cmd->args);
-		}
-		line->head = e->next;
-		free(e);
+	struct arena_chunk *c = command_line_arena(line)->chunks;
+	while (c != NULL) {
+		struct arena_chunk *next = c->next;
+		free(c);
+		c = next;
 	}
-	free(line->out_file);
-	free(line);
 }
 
 static void
@@ -111,6 +291,19 @@ void
 parser_feed(struct parser *p, const char *str, uint32_t len)
 {
 	uint32_t cap = p->capacity - p->size;
+	if (cap < len && p->offset > 0 && p->offset >= p->size - p->offset) {
+		/*
+		 * At least half of the buffer is consumed already. Moving the
+		 * rest to the front costs not more than the consumed data, so
+		 * it is amortized to O(1) per byte.
+		 */
+		uint32_t size = p->size - p->offset;
+		memmove(p->buffer, p->buffer + p->offset, size);
+		p->pos -= p->offset;
+		p->offset = 0;
+		p->size = size;
+		cap = p->capacity - p->size;
+	}
 	if (cap < len) {
 		uint32_t new_capacity = (p->capacity + 1) * 2;
 		if (new_capacity - p->size < len)
@@ -123,16 +316,96 @@ parser_feed(struct parser *p, const char *str, uint32_t len)
 	assert(p->size <= p->capacity);
 }
 
+/** Everything before the parser position is not needed anymore. */
 static void
-parser_consume(struct parser *p, uint32_t size)
+parser_consume(struct parser *p)
 {
-	assert(p->size >= size);
-	if (size == p->size) {
+	assert(p->pos <= p->size);
+	if (p->pos == p->size) {
+		p->offset = 0;
 		p->size = 0;
+		p->pos = 0;
 		return;
 	}
-	memmove(p->buffer, p->buffer + size, p->size - size);
-	p->size -= size;
+	p->offset = p->pos;
+}
+
+/**
+ * Bytes which can't be just appended to a token and need a closer look.
+ * Which ones depend on the quotes the token is in.
+ */
+enum {
+	CHAR_SPECIAL_NO_QUOTE = 1 << 0,
+	CHAR_SPECIAL_SINGLE_QUOTE = 1 << 1,
+	CHAR_SPECIAL_DOUBLE_QUOTE = 1 << 2,
+};
+
+static const uint8_t char_special[256] = {
+	['\''] = CHAR_SPECIAL_NO_QUOTE | CHAR_SPECIAL_SINGLE_QUOTE,
+	['"'] = CHAR_SPECIAL_NO_QUOTE | CHAR_SPECIAL_DOUBLE_QUOTE,
+	['\\'] = CHAR_SPECIAL_NO_QUOTE | CHAR_SPECIAL_DOUBLE_QUOTE,
+	['&'] = CHAR_SPECIAL_NO_QUOTE,
+	['|'] = CHAR_SPECIAL_NO_QUOTE,
+	['>'] = CHAR_SPECIAL_NO_QUOTE,
+	[' '] = CHAR_SPECIAL_NO_QUOTE,
+	['\t'] = CHAR_SPECIAL_NO_QUOTE,
+	['\r'] = CHAR_SPECIAL_NO_QUOTE,
+	['\n'] = CHAR_SPECIAL_NO_QUOTE,
+	['#'] = CHAR_SPECIAL_NO_QUOTE,
+};
+
+/**
+ * Find the end of the run of plain bytes starting at @a pos, so the whole
+ * run can be appended to the token at once. With SSE2 16 bytes are checked
+ * per step. It may stop at a few more bytes than needed, such as other
+ * control characters, which is fine - parse_token() appends them one by one.
+ */
+static inline const char *
+scan_plain(const char *pos, const char *end, char quote)
+{
+#ifdef __SSE2__
+	for (; end - pos >= 16; pos += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *)pos);
+		__m128i m;
+		if (quote == 0) {
+			/* Space, \t, \r, \n are all <= ' '. */
+			m = _mm_cmpeq_epi8(_mm_min_epu8(v, _mm_set1_epi8(' ')),
+					   v);
+			m = _mm_or_si128(m, _mm_cmpeq_epi8(v,
+				_mm_set1_epi8('\'')));
+			m = _mm_or_si128(m, _mm_cmpeq_epi8(v,
+				_mm_set1_epi8('"')));
+			m = _mm_or_si128(m, _mm_cmpeq_epi8(v,
+				_mm_set1_epi8('\\')));
+			m = _mm_or_si128(m, _mm_cmpeq_epi8(v,
+				_mm_set1_epi8('&')));
+			m = _mm_or_si128(m, _mm_cmpeq_epi8(v,
+				_mm_set1_epi8('|')));
+			m = _mm_or_si128(m, _mm_cmpeq_epi8(v,
+				_mm_set1_epi8('>')));
+			m = _mm_or_si128(m, _mm_cmpeq_epi8(v,
+				_mm_set1_epi8('#')));
+		} else if (quote == '\'') {
+			m = _mm_cmpeq_epi8(v, _mm_set1_epi8('\''));
+		} else {
+			m = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('"')),
+				_mm_cmpeq_epi8(v, _mm_set1_epi8('\\')));
+		}
+		int bits = _mm_movemask_epi8(m);
+		if (bits != 0)
+			return pos + __builtin_ctz(bits);
+	}
+#endif
+	uint8_t mask;
+	if (quote == 0)
+		mask = CHAR_SPECIAL_NO_QUOTE;
+	else if (quote == '\'')
+		mask = CHAR_SPECIAL_SINGLE_QUOTE;
+	else
+		mask = CHAR_SPECIAL_DOUBLE_QUOTE;
+	while (pos < end && (char_special[(uint8_t)*pos] & mask) == 0)
+		++pos;
+	return pos;
 }
 
 static uint32_t
@@ -151,6 +424,13 @@ parse_token(const char *pos, const char *end, struct token *out)
 	}
 	char quote = 0;
 	while (pos < end) {
+		const char *plain_end = scan_plain(pos, end, quote);
+		if (plain_end != pos) {
+			token_append(out, pos, plain_end - pos);
+			pos = plain_end;
+			if (pos == end)
+				break;
+		}
 		char c = *pos;
 		switch(c) {
 		case '\'':
@@ -186,7 +466,8 @@ parse_token(const char *pos, const char *end, struct token *out)
 				default:
 					break;
 				}
-				token_append(out, '\\');
+				/* Keep the backslash, it is the previous byte. */
+				token_append(out, pos - 1, 1);
 				goto append_and_next;
 			}
 			assert(quote == 0);
@@ -265,178 +546,190 @@ parse_token(const char *pos, const char *end, struct token *out)
 				out->type = TOKEN_TYPE_STR;
 				return pos - begin;
 			}
-			++pos;
-			while (pos < end) {
-				if (*pos == '\n') {
-					out->type = TOKEN_TYPE_NEW_LINE;
-					return pos + 1 - begin;
-				}
-				++pos;
-			}
-			return 0;
+			pos = memchr(pos, '\n', end - pos);
+			if (pos == NULL)
+				return 0;
+			out->type = TOKEN_TYPE_NEW_LINE;
+			return pos + 1 - begin;
 		default:
 			goto append_and_next;
 		}
 	append_and_next:
-		token_append(out, c);
+		token_append(out, pos, 1);
 		++pos;
 	}
 	return 0;
 }
 
-enum parser_error
-parser_pop_next(struct parser *p, struct command_line **out)
+static void
+parser_fail(struct parser *p, enum parser_error err)
 {
-	struct command_line *line = calloc(1, sizeof(*line));
-	char *pos = p->buffer;
-	const char *begin = pos;
-	char *end = pos + p->size;
-	struct token token = {0};
-	enum parser_error res = PARSER_ERR_NONE;
+	p->state = PARSER_STATE_SKIP_LINE;
+	p->error = err;
+}
 
-	while (pos < end) {
-		uint32_t used = parse_token(pos, end, &token);
-		if (used == 0)
-			goto return_no_line;
-		pos += used;
-		struct expr *e;
-		switch(token.type) {
+static void
+parser_reset_line(struct parser *p)
+{
+	if (p->line != NULL)
+		command_line_delete(p->line);
+	p->line = NULL;
+	p->state = PARSER_STATE_EXPR;
+	p->error = PARSER_ERR_NONE;
+	parser_consume(p);
+}
+
+static void
+parser_append_operator(struct parser *p, enum expr_type type,
+		       enum parser_error no_left_arg,
+		       enum parser_error left_arg_not_a_command)
+{
+	struct command_line *line = p->line;
+	if (line->tail == NULL) {
+		parser_fail(p, no_left_arg);
+		return;
+	}
+	if (line->tail->type != EXPR_TYPE_COMMAND) {
+		parser_fail(p, left_arg_not_a_command);
+		return;
+	}
+	struct expr *e = arena_calloc(command_line_arena(line), sizeof(*e));
+	e->type = type;
+	command_line_append(line, e);
+}
+
+/** Handle a token in the middle of a line. */
+static void
+parser_process_token(struct parser *p)
+{
+	struct token *token = &p->token;
+	struct command_line *line = p->line;
+	struct line_arena *arena = command_line_arena(line);
+	struct expr *e;
+
+	switch (p->state) {
+	case PARSER_STATE_EXPR:
+		switch (token->type) {
 		case TOKEN_TYPE_STR:
-			if (line->tail != NULL && line->tail->type == EXPR_TYPE_COMMAND) {
-				command_append_arg(&line->tail->cmd, token_strdup(&token));
-				continue;
+			if (line->tail != NULL &&
+			    line->tail->type == EXPR_TYPE_COMMAND) {
+				command_append_arg(arena, &line->tail->cmd,
+						   token_strdup(arena, token));
+				return;
 			}
-			e = calloc(1, sizeof(*e));
+			e = arena_calloc(arena, sizeof(*e));
 			e->type = EXPR_TYPE_COMMAND;
-			e->cmd.exe = token_strdup(&token);
+			e->cmd.exe = token_strdup(arena, token);
 			command_line_append(line, e);
-			continue;
-		case TOKEN_TYPE_NEW_LINE:
-			/* Skip new lines. */
-			if (line->tail == NULL)
-				continue;
-			goto close_and_return;
+			return;
 		case TOKEN_TYPE_PIPE:
-			if (line->tail == NULL) {
-				res = PARSER_ERR_PIPE_WITH_NO_LEFT_ARG;
-				goto return_error;
-			}
-			if (line->tail->type != EXPR_TYPE_COMMAND) {
-				res = PARSER_ERR_PIPE_WITH_LEFT_ARG_NOT_A_COMMAND;
-				goto return_error;
-			}
-			e = calloc(1, sizeof(*e));
-			e->type = EXPR_TYPE_PIPE;
-			command_line_append(line, e);
-			continue;
+			parser_append_operator(p, EXPR_TYPE_PIPE,
+				PARSER_ERR_PIPE_WITH_NO_LEFT_ARG,
+				PARSER_ERR_PIPE_WITH_LEFT_ARG_NOT_A_COMMAND);
+			return;
 		case TOKEN_TYPE_AND:
-			if (line->tail == NULL) {
-				res = PARSER_ERR_AND_WITH_NO_LEFT_ARG;
-				goto return_error;
-			}
-			if (line->tail->type != EXPR_TYPE_COMMAND) {
-				res = PARSER_ERR_AND_WITH_LEFT_ARG_NOT_A_COMMAND;
-				goto return_error;
-			}
-			e = calloc(1, sizeof(*e));
-			e->type = EXPR_TYPE_AND;
-			command_line_append(line, e);
-			continue;
+			parser_append_operator(p, EXPR_TYPE_AND,
+				PARSER_ERR_AND_WITH_NO_LEFT_ARG,
+				PARSER_ERR_AND_WITH_LEFT_ARG_NOT_A_COMMAND);
+			return;
 		case TOKEN_TYPE_OR:
-			if (line->tail == NULL) {
-				res = PARSER_ERR_OR_WITH_NO_LEFT_ARG;
-				goto return_error;
-			}
-			if (line->tail->type != EXPR_TYPE_COMMAND) {
-				res = PARSER_ERR_OR_WITH_LEFT_ARG_NOT_A_COMMAND;
-				goto return_error;
-			}
-			e = calloc(1, sizeof(*e));
-			e->type = EXPR_TYPE_OR;
-			command_line_append(line, e);
-			continue;
+			parser_append_operator(p, EXPR_TYPE_OR,
+				PARSER_ERR_OR_WITH_NO_LEFT_ARG,
+				PARSER_ERR_OR_WITH_LEFT_ARG_NOT_A_COMMAND);
+			return;
 		case TOKEN_TYPE_OUT_NEW:
+			line->out_type = OUTPUT_TYPE_FILE_NEW;
+			p->state = PARSER_STATE_OUT_FILE;
+			return;
 		case TOKEN_TYPE_OUT_APPEND:
+			line->out_type = OUTPUT_TYPE_FILE_APPEND;
+			p->state = PARSER_STATE_OUT_FILE;
+			return;
 		case TOKEN_TYPE_BACKGROUND:
-			goto close_and_return;
+			line->is_background = true;
+			p->state = PARSER_STATE_BACKGROUND;
+			return;
 		default:
 			assert(false);
+			return;
 		}
-	}
-	goto return_no_line;
-
-close_and_return:
-	if (token.type == TOKEN_TYPE_OUT_NEW || token.type == TOKEN_TYPE_OUT_APPEND)
-	{
-		if (token.type == TOKEN_TYPE_OUT_NEW)
-			line->out_type = OUTPUT_TYPE_FILE_NEW;
-		else
-			line->out_type = OUTPUT_TYPE_FILE_APPEND;
-		uint32_t used = parse_token(pos, end, &token);
-		if (used == 0)
-			goto return_no_line;
-		pos += used;
-		if (token.type != TOKEN_TYPE_STR) {
-			res = PARSER_ERR_OUTOUT_REDIRECT_BAD_ARG;
-			goto return_error;
+	case PARSER_STATE_OUT_FILE:
+		if (token->type != TOKEN_TYPE_STR) {
+			parser_fail(p, PARSER_ERR_OUTOUT_REDIRECT_BAD_ARG);
+			return;
 		}
-		line->out_file = token_strdup(&token);
-		used = parse_token(pos, end, &token);
-		if (used == 0)
-			goto return_no_line;
-		pos += used;
-	}
-	if (token.type == TOKEN_TYPE_BACKGROUND) {
-		line->is_background = true;
-		uint32_t used = parse_token(pos, end, &token);
-		if (used == 0)
-			goto return_no_line;
-		pos += used;
-	}
-	if (token.type == TOKEN_TYPE_NEW_LINE) {
-		assert(line->tail != NULL);
-		parser_consume(p, pos - begin);
-		if (line->tail->type != EXPR_TYPE_COMMAND) {
-			res = PARSER_ERR_ENDS_NOT_WITH_A_COMMAND;
-			goto return_no_line;
+		line->out_file = token_strdup(arena, token);
+		p->state = PARSER_STATE_OUT_FILE_DONE;
+		return;
+	case PARSER_STATE_OUT_FILE_DONE:
+		if (token->type != TOKEN_TYPE_BACKGROUND) {
+			parser_fail(p, PARSER_ERR_TOO_LATE_ARGUMENTS);
+			return;
 		}
-		res = PARSER_ERR_NONE;
-		*out = line;
-		goto return_final;
+		line->is_background = true;
+		p->state = PARSER_STATE_BACKGROUND;
+		return;
+	case PARSER_STATE_BACKGROUND:
+		parser_fail(p, PARSER_ERR_TOO_LATE_ARGUMENTS);
+		return;
+	case PARSER_STATE_SKIP_LINE:
+		/*
+		 * Try to skip the whole current line. It can't be executed
+		 * but can't just crash here because of that.
+		 */
+		return;
+	default:
+		assert(false);
 	}
-	res = PARSER_ERR_TOO_LATE_ARGUMENTS;
-	goto return_error;
+}
 
-return_error:
-	/*
-	 * Try to skip the whole current line. It can't be executed but can't
-	 * just crash here because of that.
-	 */
-	while (pos < end) {
-		uint32_t used = parse_token(pos, end, &token);
+enum parser_error
+parser_pop_next(struct parser *p, struct command_line **out)
+{
+	*out = NULL;
+	struct token *token = &p->token;
+	while (p->pos < p->size) {
+		uint32_t used = parse_token(p->buffer + p->pos,
+					    p->buffer + p->size, token);
 		if (used == 0)
 			break;
-		pos += used;
-		if (token.type == TOKEN_TYPE_NEW_LINE) {
-			parser_consume(p, pos - begin);
-			goto return_no_line;
+		p->pos += used;
+		if (token->type != TOKEN_TYPE_NEW_LINE) {
+			if (p->line == NULL)
+				p->line = command_line_new();
+			parser_process_token(p);
+			continue;
 		}
+		/* Skip empty lines. */
+		if (p->line == NULL && p->state == PARSER_STATE_EXPR) {
+			parser_consume(p);
+			continue;
+		}
+		struct command_line *line = p->line;
+		enum parser_error res = p->error;
+		if (p->state == PARSER_STATE_OUT_FILE) {
+			res = PARSER_ERR_OUTOUT_REDIRECT_BAD_ARG;
+		} else if (p->state != PARSER_STATE_SKIP_LINE &&
+			   (line->tail == NULL ||
+			    line->tail->type != EXPR_TYPE_COMMAND)) {
+			res = PARSER_ERR_ENDS_NOT_WITH_A_COMMAND;
+		}
+		if (res == PARSER_ERR_NONE) {
+			*out = line;
+			p->line = NULL;
+		}
+		parser_reset_line(p);
+		return res;
 	}
-	res = PARSER_ERR_NONE;
-	goto return_no_line;
-
-return_no_line:
-	command_line_delete(line);
-	*out = NULL;
-
-return_final:
-	free(token.data);
-	return res;
+	return PARSER_ERR_NONE;
 }
 
 void
 parser_delete(struct parser *p)
 {
+	if (p->line != NULL)
+		command_line_delete(p->line);
+	free(p->token.buf);
 	free(p->buffer);
 	free(p);
 }
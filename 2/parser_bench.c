@@ -0,0 +1,289 @@
+#include "parser.h"
+
+#include "heap_help.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/**
+ * Throughput benchmark of the parser. Random but valid command lines are
+ * generated for several corpora, each stressing a different part of the
+ * parser, and fed into it by chunks of different sizes. For each run the
+ * speed and the number of heap allocations made per parsed line are printed.
+ * They include the transient ones, like growth of the token buffers, which
+ * are freed before the line is popped. A realloc in place is not counted.
+ * The allocations are counted with heap_help. It makes each malloc
+ * much more expensive, which is fine: the allocations should be rare, and the
+ * ones left show up in the speed too.
+ *
+ * $> ./parser_bench [corpus size in MB]
+ *
+ * Every generated line is valid, so any parsing error is reported as a
+ * failure and the benchmark exits with a non-zero code.
+ */
+
+enum {
+	BENCH_MAX_WORD_LEN = 64,
+};
+
+/** PRNG: xorshift64*, the quality is not important here. */
+static uint64_t rng_state = 0x9e3779b97f4a7c15ull;
+
+static uint32_t
+rng_below(uint32_t bound)
+{
+	rng_state ^= rng_state >> 12;
+	rng_state ^= rng_state << 25;
+	rng_state ^= rng_state >> 27;
+	return (uint32_t)((rng_state * 0x2545f4914f6cdd1dull) >> 32) % bound;
+}
+
+struct corpus {
+	char *data;
+	size_t size;
+	size_t capacity;
+	uint32_t line_count;
+};
+
+static void
+corpus_append(struct corpus *c, const char *str, size_t len)
+{
+	if (c->size + len > c->capacity) {
+		c->capacity = (c->capacity + len) * 2;
+		c->data = realloc(c->data, c->capacity);
+	}
+	memcpy(c->data + c->size, str, len);
+	c->size += len;
+}
+
+static void
+corpus_append_char(struct corpus *c, char ch)
+{
+	corpus_append(c, &ch, 1);
+}
+
+static void
+gen_plain(struct corpus *c)
+{
+	static const char alphabet[] = "abcdefghijklmnopqrstuvwxyz0123456789-_./";
+	uint32_t len = 1 + rng_below(BENCH_MAX_WORD_LEN / 4);
+	for (uint32_t i = 0; i < len; ++i)
+		corpus_append_char(c, alphabet[rng_below(sizeof(alphabet) - 1)]);
+}
+
+/**
+ * One argument glued from many differently quoted parts with escapes, like
+ * a"b\"c"'d e'f\ g. It makes the parser switch the modes all the time and
+ * defeats the slicing of the tokens from the input buffer.
+ */
+static void
+gen_quoted(struct corpus *c)
+{
+	static const char *parts[] = {
+		"\"x \\\" y\"", "'a | b && c'", "\\ ", "\\|", "\"\\\\\"",
+		"'\"'", "\"'\"", "\"a\\\nb\"", "\"> &\"", "\\#",
+	};
+	uint32_t count = 1 + rng_below(8);
+	for (uint32_t i = 0; i < count; ++i) {
+		if (rng_below(2) == 0) {
+			gen_plain(c);
+		} else {
+			const char *p = parts[rng_below(
+				sizeof(parts) / sizeof(parts[0]))];
+			corpus_append(c, p, strlen(p));
+		}
+	}
+}
+
+/** Base64 blobs and long paths, like in 'echo <key> > /very/long/path'. */
+static void
+gen_long(struct corpus *c)
+{
+	static const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
+		"abcdefghijklmnopqrstuvwxyz0123456789+/";
+	uint32_t len = 256 + rng_below(4096);
+	for (uint32_t i = 0; i < len; ++i)
+		corpus_append_char(c, alphabet[rng_below(sizeof(alphabet) - 1)]);
+	if (rng_below(2) == 0)
+		corpus_append(c, "==", 2);
+}
+
+static void
+gen_command(struct corpus *c, bool is_quoted)
+{
+	gen_plain(c);
+	uint32_t argc = rng_below(6);
+	for (uint32_t i = 0; i < argc; ++i) {
+		corpus_append_char(c, ' ');
+		if (is_quoted)
+			gen_quoted(c);
+		else
+			gen_plain(c);
+	}
+}
+
+enum corpus_type {
+	CORPUS_SIMPLE,
+	CORPUS_QUOTES,
+	CORPUS_PIPES,
+	CORPUS_LOGIC,
+	CORPUS_MIXED,
+	CORPUS_LONG,
+	CORPUS_TYPE_COUNT,
+};
+
+static const char *corpus_names[] = {
+	"simple", "quotes", "pipes", "logic", "mixed", "long",
+};
+
+static void
+gen_line(struct corpus *c, enum corpus_type type)
+{
+	static const char *logic_ops[] = {" && ", " || "};
+	static const char *mixed_ops[] = {" | ", " && ", " || "};
+	switch (type) {
+	case CORPUS_SIMPLE:
+		gen_command(c, false);
+		break;
+	case CORPUS_QUOTES:
+		for (uint32_t i = 0, n = 1 + rng_below(4); i < n; ++i) {
+			if (i > 0)
+				corpus_append(c, " | ", 3);
+			gen_command(c, true);
+		}
+		break;
+	case CORPUS_PIPES:
+		for (uint32_t i = 0, n = 10 + rng_below(50); i < n; ++i) {
+			if (i > 0)
+				corpus_append(c, " | ", 3);
+			gen_command(c, false);
+		}
+		break;
+	case CORPUS_LOGIC:
+		for (uint32_t i = 0, n = 10 + rng_below(50); i < n; ++i) {
+			if (i > 0)
+				corpus_append(c, logic_ops[rng_below(2)], 4);
+			gen_command(c, false);
+		}
+		break;
+	case CORPUS_MIXED:
+		for (uint32_t i = 0, n = 1 + rng_below(20); i < n; ++i) {
+			if (i > 0) {
+				const char *op = mixed_ops[rng_below(3)];
+				corpus_append(c, op, strlen(op));
+			}
+			gen_command(c, rng_below(2) == 0);
+		}
+		if (rng_below(4) == 0) {
+			const char *op = rng_below(2) == 0 ? " > " : " >> ";
+			corpus_append(c, op, strlen(op));
+			gen_plain(c);
+		}
+		if (rng_below(8) == 0)
+			corpus_append(c, " &", 2);
+		if (rng_below(8) == 0)
+			corpus_append(c, " # comment | && ||", 18);
+		break;
+	case CORPUS_LONG:
+		gen_plain(c);
+		for (uint32_t i = 0, n = 1 + rng_below(4); i < n; ++i) {
+			corpus_append_char(c, ' ');
+			gen_long(c);
+		}
+		corpus_append(c, " > ", 3);
+		gen_long(c);
+		break;
+	default:
+		abort();
+	}
+	corpus_append_char(c, '\n');
+	++c->line_count;
+}
+
+static void
+corpus_generate(struct corpus *c, enum corpus_type type, size_t size)
+{
+	while (c->size < size)
+		gen_line(c, type);
+}
+
+static double
+now_sec(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * Parse the whole corpus, feeding it by chunks of the given size. Returns
+ * false if any line failed to parse.
+ */
+static bool
+bench_run(const struct corpus *c, const char *name, uint32_t chunk_size)
+{
+	struct parser *p = parser_new();
+	uint32_t line_count = 0;
+	uint32_t error_count = 0;
+	uint64_t allocs_before = heaph_get_alloc_count_total();
+	double start = now_sec();
+	for (size_t pos = 0; pos < c->size;) {
+		uint32_t size = chunk_size;
+		if (size > c->size - pos)
+			size = c->size - pos;
+		parser_feed(p, c->data + pos, size);
+		pos += size;
+		while (true) {
+			struct command_line *line = NULL;
+			enum parser_error err = parser_pop_next(p, &line);
+			if (err != PARSER_ERR_NONE) {
+				++error_count;
+				continue;
+			}
+			if (line == NULL)
+				break;
+			++line_count;
+			command_line_delete(line);
+		}
+	}
+	double duration = now_sec() - start;
+	uint64_t allocs = heaph_get_alloc_count_total() - allocs_before;
+	parser_delete(p);
+
+	printf("%-8s chunk %6u: %8.2f MB/sec, %6.2f allocs/line",
+	       name, chunk_size, c->size / duration / (1024 * 1024),
+	       line_count == 0 ? 0.0 : (double)allocs / line_count);
+	if (line_count != c->line_count || error_count != 0) {
+		printf(" - FAILED, %u of %u lines, %u errors\n", line_count,
+		       c->line_count, error_count);
+		return false;
+	}
+	printf("\n");
+	return true;
+}
+
+int
+main(int argc, char **argv)
+{
+	size_t size_mb = 4;
+	if (argc > 1)
+		size_mb = strtoul(argv[1], NULL, 10);
+	if (size_mb == 0) {
+		fprintf(stderr, "Usage: %s [corpus size in MB]\n", argv[0]);
+		return 1;
+	}
+	static const uint32_t chunk_sizes[] = {1, 16, 256, 4096, 65536};
+	bool ok = true;
+	for (int type = 0; type < CORPUS_TYPE_COUNT; ++type) {
+		struct corpus c;
+		memset(&c, 0, sizeof(c));
+		corpus_generate(&c, type, size_mb * 1024 * 1024);
+		for (size_t i = 0; i < sizeof(chunk_sizes) /
+		     sizeof(chunk_sizes[0]); ++i)
+			ok = bench_run(&c, corpus_names[type], chunk_sizes[i]) && ok;
+		free(c.data);
+	}
+	return ok ? 0 : 1;
+}
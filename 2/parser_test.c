@@ -2,6 +2,7 @@
 
 #include "unit.h"
 
+#include <stdio.h>
 #include <string.h>
 
 static void
@@ -819,6 +820,93 @@ test_errors(void)
 	unit_test_finish();
 }
 
+static void
+test_many_args(void)
+{
+	unit_test_start();
+	struct parser *p = parser_new();
+	struct command_line *line = NULL;
+
+	const int count = 1000;
+	char arg[32];
+	parser_feed(p, "echo", 4);
+	for (int i = 0; i < count; ++i) {
+		int len = sprintf(arg, " arg%d", i);
+		parser_feed(p, arg, len);
+	}
+	/* Long argument, bigger than a usual memory chunk of a line. */
+	char long_arg[4096];
+	memset(long_arg, 'a', sizeof(long_arg));
+	long_arg[0] = ' ';
+	parser_feed(p, long_arg, sizeof(long_arg));
+	parser_feed(p, " last\n", 6);
+	unit_check(parser_pop_next(p, &line) == PARSER_ERR_NONE, "parse");
+	struct expr *e = line->head;
+	unit_check(e->type == EXPR_TYPE_COMMAND, "expr type");
+	unit_check(strcmp(e->cmd.exe, "echo") == 0, "exe");
+	unit_check(e->cmd.arg_count == (uint32_t)count + 2, "arg count");
+	bool ok = true;
+	for (int i = 0; i < count && ok; ++i) {
+		sprintf(arg, "arg%d", i);
+		ok = strcmp(e->cmd.args[i], arg) == 0;
+	}
+	unit_check(ok, "args");
+	unit_check(strlen(e->cmd.args[count]) == sizeof(long_arg) - 1 &&
+		   e->cmd.args[count][0] == 'a', "long arg");
+	unit_check(strcmp(e->cmd.args[count + 1], "last") == 0, "last arg");
+	unit_check(e->next == NULL, "no more exprs");
+	command_line_delete(line);
+
+	parser_delete(p);
+	unit_test_finish();
+}
+
+static void
+test_long_words(void)
+{
+	unit_test_start();
+	struct parser *p = parser_new();
+	struct command_line *line = NULL;
+
+	/*
+	 * Plain runs of the words are scanned by big blocks. Put the special
+	 * bytes at all the offsets to hit each position inside a block.
+	 */
+	char a[64], b[64], src[512], expected[512];
+	bool ok = true;
+	for (int len = 1; len < 48 && ok; ++len) {
+		memset(a, 'a', len);
+		a[len] = 0;
+		memset(b, 'b', len);
+		b[len] = 0;
+		sprintf(src, "%s\"q \\\" '|'%s\" '%s\"\\|%s' %s|%s#%s\n",
+			a, b, a, b, a, b, a);
+		parser_feed(p, src, strlen(src));
+		ok = parser_pop_next(p, &line) == PARSER_ERR_NONE &&
+			line != NULL;
+		if (!ok)
+			break;
+		struct expr *e = line->head;
+		sprintf(expected, "%sq \" '|'%s", a, b);
+		ok = ok && e->type == EXPR_TYPE_COMMAND &&
+			strcmp(e->cmd.exe, expected) == 0 &&
+			e->cmd.arg_count == 2;
+		sprintf(expected, "%s\"\\|%s", a, b);
+		ok = ok && strcmp(e->cmd.args[0], expected) == 0 &&
+			strcmp(e->cmd.args[1], a) == 0;
+		e = e->next;
+		ok = ok && e != NULL && e->type == EXPR_TYPE_PIPE;
+		e = e->next;
+		ok = ok && e != NULL && strcmp(e->cmd.exe, b) == 0 &&
+			e->cmd.arg_count == 0 && e->next == NULL;
+		command_line_delete(line);
+	}
+	unit_check(ok, "special bytes at all offsets");
+
+	parser_delete(p);
+	unit_test_finish();
+}
+
 int
 main(void)
 {
@@ -834,5 +922,7 @@ main(void)
 	test_logical_operators();
 	test_background();
 	test_errors();
+	test_many_args();
+	test_long_words();
 	return 0;
 }
@@ -1,71 +1,1667 @@
+#define _GNU_SOURCE
+
 #include "parser.h"
 
 #include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdarg.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
 #include <unistd.h>
 
+extern char **environ;
+
+/**
+ * How the commands are started. fork() copies page tables of the shell, so it
+ * gets slower as the shell grows. posix_spawn() in glibc is done via
+ * clone(CLONE_VM | CLONE_VFORK), its cost does not depend on the shell size.
+ */
+enum launcher {
+	LAUNCHER_SPAWN,
+	LAUNCHER_FORK,
+};
+
+/**
+ * Cache of the full paths of the commands found in $PATH. Without it each
+ * start of a command walks $PATH with failed execve() calls. The cache is
+ * dropped when $PATH changes and by 'hash -r'.
+ */
+struct path_cache_entry {
+	char *name;
+	char *path;
+};
+
+struct path_cache {
+	/** Open addressing hash table, size is a power of 2. */
+	struct path_cache_entry *entries;
+	uint32_t capacity;
+	uint32_t count;
+	/** $PATH the cache was built for. */
+	char *path_env;
+};
+
+enum {
+	/** Bigger pipes mean less context switches on heavy pipelines. */
+	SHELL_PIPE_SIZE = 1024 * 1024,
+	/** How much to splice() at once. */
+	SHELL_COPY_CHUNK = 1024 * 1024,
+	SHELL_COPY_BUF_SIZE = 128 * 1024,
+};
+
+/**
+ * Background jobs. They are reaped via signalfd(SIGCHLD) which is polled
+ * together with the input, so the shell never blocks on them and they
+ * don't stay zombies.
+ */
+struct job {
+	/** 0 means a free slot. */
+	pid_t pid;
+	uint32_t id;
+};
+
+struct job_table {
+	/** Open addressing hash table by pid, size is a power of 2. */
+	struct job *jobs;
+	uint32_t capacity;
+	uint32_t count;
+	uint32_t next_id;
+	/** SIGCHLD is blocked and delivered into this descriptor. */
+	int signal_fd;
+	/** Signal mask of the shell before SIGCHLD was blocked. */
+	sigset_t old_mask;
+};
+
+static inline uint32_t
+job_hash(pid_t pid)
+{
+	return (uint32_t)pid * 2654435761u;
+}
+
+static int
+job_table_create(struct job_table *t)
+{
+	memset(t, 0, sizeof(*t));
+	sigset_t mask;
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGCHLD);
+	if (sigprocmask(SIG_BLOCK, &mask, &t->old_mask) != 0)
+		return -1;
+	t->signal_fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+	return t->signal_fd < 0 ? -1 : 0;
+}
+
 static void
-execute_command_line(const struct command_line *line)
+job_table_destroy(struct job_table *t)
 {
-	/* REPLACE THIS CODE WITH ACTUAL COMMAND EXECUTION */
+	if (t->signal_fd >= 0)
+		close(t->signal_fd);
+	free(t->jobs);
+}
 
-	assert(line != NULL);
-	printf("================================\n");
-	printf("Command line:\n");
-	printf("Is background: %d\n", (int)line->is_background);
-	printf("Output: ");
-	if (line->out_type == OUTPUT_TYPE_STDOUT) {
-		printf("stdout\n");
-	} else if (line->out_type == OUTPUT_TYPE_FILE_NEW) {
-		printf("new file - \"%s\"\n", line->out_file);
-	} else if (line->out_type == OUTPUT_TYPE_FILE_APPEND) {
-		printf("append file - \"%s\"\n", line->out_file);
+static struct job *
+job_table_slot(struct job *jobs, uint32_t capacity, pid_t pid)
+{
+	uint32_t mask = capacity - 1;
+	uint32_t i = job_hash(pid) & mask;
+	while (jobs[i].pid != 0 && jobs[i].pid != pid)
+		i = (i + 1) & mask;
+	return &jobs[i];
+}
+
+static void
+job_table_add(struct job_table *t, pid_t pid)
+{
+	if ((t->count + 1) * 2 > t->capacity) {
+		uint32_t new_capacity = t->capacity == 0 ? 64 : t->capacity * 2;
+		struct job *jobs = calloc(new_capacity, sizeof(*jobs));
+		for (uint32_t i = 0; i < t->capacity; ++i) {
+			if (t->jobs[i].pid != 0) {
+				*job_table_slot(jobs, new_capacity,
+						t->jobs[i].pid) = t->jobs[i];
+			}
+		}
+		free(t->jobs);
+		t->jobs = jobs;
+		t->capacity = new_capacity;
+	}
+	struct job *j = job_table_slot(t->jobs, t->capacity, pid);
+	assert(j->pid == 0);
+	j->pid = pid;
+	j->id = ++t->next_id;
+	++t->count;
+}
+
+static void
+job_table_remove(struct job_table *t, pid_t pid)
+{
+	if (t->count == 0)
+		return;
+	struct job *j = job_table_slot(t->jobs, t->capacity, pid);
+	if (j->pid == 0)
+		return;
+	/* Backward shift deletion keeps the probe chains without holes. */
+	uint32_t mask = t->capacity - 1;
+	uint32_t i = j - t->jobs;
+	t->jobs[i].pid = 0;
+	uint32_t k = i;
+	while (true) {
+		k = (k + 1) & mask;
+		if (t->jobs[k].pid == 0)
+			break;
+		uint32_t home = job_hash(t->jobs[k].pid) & mask;
+		bool is_in_place = i <= k ? (i < home && home <= k) :
+					    (i < home || home <= k);
+		if (is_in_place)
+			continue;
+		t->jobs[i] = t->jobs[k];
+		t->jobs[k].pid = 0;
+		i = k;
+	}
+	if (--t->count == 0)
+		t->next_id = 0;
+}
+
+/** Collect all the finished jobs without blocking. */
+static void
+job_table_reap(struct job_table *t)
+{
+	struct signalfd_siginfo info[16];
+	/* The signals are coalesced anyway, waitpid() finds all the jobs. */
+	while (read(t->signal_fd, info, sizeof(info)) > 0)
+		;
+	pid_t pid;
+	while ((pid = waitpid(-1, NULL, WNOHANG)) > 0)
+		job_table_remove(t, pid);
+}
+
+/** Block until all the jobs are finished. */
+static void
+job_table_wait_all(struct job_table *t)
+{
+	while (t->count > 0) {
+		pid_t pid = waitpid(-1, NULL, 0);
+		if (pid > 0) {
+			job_table_remove(t, pid);
+			continue;
+		}
+		if (errno == EINTR)
+			continue;
+		/* No children at all, the table is out of sync. */
+		memset(t->jobs, 0, sizeof(*t->jobs) * t->capacity);
+		t->count = 0;
+		t->next_id = 0;
+	}
+}
+
+struct shell {
+	enum launcher launcher;
+	/** Exit code of the last executed command. */
+	int last_status;
+	bool is_exit_requested;
+	/** Reusable argv array to start commands with. */
+	char **argv;
+	uint32_t argv_capacity;
+	/** Reusable array of the current pipeline's process IDs. */
+	pid_t *pids;
+	uint32_t pid_capacity;
+	struct path_cache path_cache;
+	struct job_table jobs;
+	/** Restores the signal mask in the spawned commands. */
+	posix_spawnattr_t spawn_attr;
+};
+
+static uint32_t
+path_cache_hash(const char *name)
+{
+	/* FNV-1a. */
+	uint32_t h = 2166136261u;
+	for (; *name != 0; ++name)
+		h = (h ^ (unsigned char)*name) * 16777619u;
+	return h;
+}
+
+static void
+path_cache_clear(struct path_cache *c)
+{
+	for (uint32_t i = 0; i < c->capacity; ++i) {
+		free(c->entries[i].name);
+		free(c->entries[i].path);
+	}
+	free(c->entries);
+	free(c->path_env);
+	memset(c, 0, sizeof(*c));
+}
+
+static struct path_cache_entry *
+path_cache_slot(struct path_cache_entry *entries, uint32_t capacity,
+		const char *name)
+{
+	uint32_t mask = capacity - 1;
+	uint32_t i = path_cache_hash(name) & mask;
+	while (entries[i].name != NULL && strcmp(entries[i].name, name) != 0)
+		i = (i + 1) & mask;
+	return &entries[i];
+}
+
+static const char *
+path_cache_put(struct path_cache *c, const char *name, const char *path)
+{
+	if ((c->count + 1) * 2 > c->capacity) {
+		uint32_t new_capacity = c->capacity == 0 ? 64 : c->capacity * 2;
+		struct path_cache_entry *entries =
+			calloc(new_capacity, sizeof(*entries));
+		for (uint32_t i = 0; i < c->capacity; ++i) {
+			if (c->entries[i].name == NULL)
+				continue;
+			*path_cache_slot(entries, new_capacity,
+					 c->entries[i].name) = c->entries[i];
+		}
+		free(c->entries);
+		c->entries = entries;
+		c->capacity = new_capacity;
+	}
+	struct path_cache_entry *e =
+		path_cache_slot(c->entries, c->capacity, name);
+	if (e->name != NULL) {
+		free(e->path);
 	} else {
-		assert(false);
+		e->name = strdup(name);
+		++c->count;
+	}
+	e->path = strdup(path);
+	return e->path;
+}
+
+/** Drop the cache if $PATH was changed since it was filled. */
+static void
+path_cache_check_env(struct path_cache *c)
+{
+	const char *env = getenv("PATH");
+	if (env == NULL)
+		env = "";
+	if (c->path_env != NULL && strcmp(c->path_env, env) == 0)
+		return;
+	path_cache_clear(c);
+	c->path_env = strdup(env);
+}
+
+/**
+ * Find the full path of the command @a name. Names with a slash are used as
+ * is. Returns NULL if the command is not found.
+ */
+static const char *
+path_cache_find(struct path_cache *c, const char *name)
+{
+	if (strchr(name, '/') != NULL)
+		return name;
+	path_cache_check_env(c);
+	if (c->capacity > 0) {
+		struct path_cache_entry *e =
+			path_cache_slot(c->entries, c->capacity, name);
+		if (e->name != NULL)
+			return e->path;
+	}
+	size_t name_len = strlen(name);
+	const char *dir = c->path_env;
+	char *path = NULL;
+	const char *found = NULL;
+	while (found == NULL) {
+		const char *end = strchrnul(dir, ':');
+		size_t dir_len = end - dir;
+		path = realloc(path, dir_len + name_len + 3);
+		/* An empty entry in $PATH means the current directory. */
+		if (dir_len == 0)
+			path[dir_len++] = '.';
+		else
+			memcpy(path, dir, dir_len);
+		path[dir_len] = '/';
+		memcpy(path + dir_len + 1, name, name_len + 1);
+		if (access(path, X_OK) == 0)
+			found = path_cache_put(c, name, path);
+		if (*end == 0)
+			break;
+		dir = end + 1;
+	}
+	free(path);
+	return found;
+}
+
+/** Commands which are executed by the shell itself. */
+struct builtin {
+	const char *name;
+	int (*func)(struct shell *sh, const struct command *cmd, int out_fd);
+	/**
+	 * Optional check if the shell can do this command itself. If not,
+	 * the real executable is started.
+	 */
+	bool (*accepts)(const struct command *cmd);
+	/**
+	 * Executed only in a forked pipeline stage, never in the shell
+	 * itself. A long copy would block the shell, and SIGPIPE would kill
+	 * it.
+	 */
+	bool is_forked_only;
+};
+
+static int
+builtin_cd(struct shell *sh, const struct command *cmd, int out_fd)
+{
+	(void)sh;
+	(void)out_fd;
+	const char *dir = cmd->arg_count > 0 ? cmd->args[0] : getenv("HOME");
+	if (dir == NULL) {
+		fprintf(stderr, "cd: HOME not set\n");
+		return 1;
+	}
+	if (chdir(dir) != 0) {
+		fprintf(stderr, "cd: %s: %s\n", dir, strerror(errno));
+		return 1;
+	}
+	return 0;
+}
+
+static int
+builtin_exit(struct shell *sh, const struct command *cmd, int out_fd)
+{
+	(void)out_fd;
+	sh->is_exit_requested = true;
+	if (cmd->arg_count > 0)
+		return atoi(cmd->args[0]) & 0xff;
+	return sh->last_status;
+}
+
+/** Write the whole buffer, a pipe can take it in parts. */
+static int
+write_all(int fd, const char *data, size_t size)
+{
+	while (size > 0) {
+		ssize_t rc = write(fd, data, size);
+		if (rc < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		data += rc;
+		size -= rc;
+	}
+	return 0;
+}
+
+static int
+builtin_true(struct shell *sh, const struct command *cmd, int out_fd)
+{
+	(void)sh;
+	(void)cmd;
+	(void)out_fd;
+	return 0;
+}
+
+static int
+builtin_false(struct shell *sh, const struct command *cmd, int out_fd)
+{
+	(void)sh;
+	(void)cmd;
+	(void)out_fd;
+	return 1;
+}
+
+static int
+builtin_echo(struct shell *sh, const struct command *cmd, int out_fd)
+{
+	(void)sh;
+	uint32_t i = 0;
+	bool is_newline_needed = true;
+	if (cmd->arg_count > 0 && strcmp(cmd->args[0], "-n") == 0) {
+		is_newline_needed = false;
+		++i;
+	}
+	/* Build the whole output to write it at once. */
+	size_t size = 1;
+	for (uint32_t j = i; j < cmd->arg_count; ++j)
+		size += strlen(cmd->args[j]) + 1;
+	char *buf = malloc(size);
+	char *pos = buf;
+	for (; i < cmd->arg_count; ++i) {
+		size_t len = strlen(cmd->args[i]);
+		memcpy(pos, cmd->args[i], len);
+		pos += len;
+		if (i + 1 < cmd->arg_count)
+			*pos++ = ' ';
+	}
+	if (is_newline_needed)
+		*pos++ = '\n';
+	int rc = write_all(out_fd, buf, pos - buf);
+	free(buf);
+	return rc == 0 ? 0 : 1;
+}
+
+static int
+builtin_pwd(struct shell *sh, const struct command *cmd, int out_fd)
+{
+	(void)sh;
+	(void)cmd;
+	char *dir = getcwd(NULL, 0);
+	if (dir == NULL) {
+		fprintf(stderr, "pwd: %s\n", strerror(errno));
+		return 1;
+	}
+	size_t len = strlen(dir);
+	char *line = malloc(len + 1);
+	memcpy(line, dir, len);
+	line[len] = '\n';
+	int rc = write_all(out_fd, line, len + 1);
+	free(line);
+	free(dir);
+	return rc == 0 ? 0 : 1;
+}
+
+/**
+ * Move all the data from @a in_fd to @a out_fd. splice() moves pages between
+ * a pipe and another descriptor without copying them through the user space.
+ * It needs a pipe on at least one side, otherwise the plain read() + write()
+ * copy is used.
+ */
+static int
+transfer_fd(int in_fd, int out_fd)
+{
+	while (true) {
+		ssize_t rc = splice(in_fd, NULL, out_fd, NULL, SHELL_COPY_CHUNK,
+				    SPLICE_F_MOVE);
+		if (rc > 0)
+			continue;
+		if (rc == 0)
+			return 0;
+		if (errno == EINTR)
+			continue;
+		if (errno == EINVAL)
+			break;
+		return -1;
+	}
+	char *buf = malloc(SHELL_COPY_BUF_SIZE);
+	int res = 0;
+	while (true) {
+		ssize_t rc = read(in_fd, buf, SHELL_COPY_BUF_SIZE);
+		if (rc == 0)
+			break;
+		if (rc < 0) {
+			if (errno == EINTR)
+				continue;
+			res = -1;
+			break;
+		}
+		if (write_all(out_fd, buf, rc) != 0) {
+			res = -1;
+			break;
+		}
+	}
+	free(buf);
+	return res;
+}
+
+/** Only the plain 'cat [file ...]' is done by the shell. */
+static bool
+builtin_cat_accepts(const struct command *cmd)
+{
+	for (uint32_t i = 0; i < cmd->arg_count; ++i) {
+		if (cmd->args[i][0] == '-' && cmd->args[i][1] != 0)
+			return false;
+	}
+	return true;
+}
+
+static int
+builtin_cat(struct shell *sh, const struct command *cmd, int out_fd)
+{
+	(void)sh;
+	if (cmd->arg_count == 0)
+		return transfer_fd(STDIN_FILENO, out_fd) == 0 ? 0 : 1;
+	int status = 0;
+	for (uint32_t i = 0; i < cmd->arg_count; ++i) {
+		const char *name = cmd->args[i];
+		int fd = STDIN_FILENO;
+		if (strcmp(name, "-") != 0) {
+			fd = open(name, O_RDONLY | O_CLOEXEC);
+			if (fd < 0) {
+				fprintf(stderr, "cat: %s: %s\n", name,
+					strerror(errno));
+				status = 1;
+				continue;
+			}
+		}
+		if (transfer_fd(fd, out_fd) != 0) {
+			fprintf(stderr, "cat: %s: %s\n", name, strerror(errno));
+			status = 1;
+		}
+		if (fd != STDIN_FILENO)
+			close(fd);
+	}
+	return status;
+}
+
+/** Only 'tee [-a] [file ...]' is done by the shell. */
+static bool
+builtin_tee_accepts(const struct command *cmd)
+{
+	for (uint32_t i = 0; i < cmd->arg_count; ++i) {
+		const char *arg = cmd->args[i];
+		if (arg[0] == '-' && strcmp(arg, "-a") != 0)
+			return false;
+	}
+	return true;
+}
+
+static int
+builtin_tee(struct shell *sh, const struct command *cmd, int out_fd)
+{
+	(void)sh;
+	int flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+	uint32_t first = 0;
+	if (cmd->arg_count > 0 && strcmp(cmd->args[0], "-a") == 0) {
+		flags = O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC;
+		first = 1;
+	}
+	int status = 0;
+	uint32_t fd_count = 0;
+	int *fds = malloc(sizeof(*fds) * (cmd->arg_count + 1));
+	for (uint32_t i = first; i < cmd->arg_count; ++i) {
+		int fd = open(cmd->args[i], flags, 0644);
+		if (fd < 0) {
+			fprintf(stderr, "tee: %s: %s\n", cmd->args[i],
+				strerror(errno));
+			status = 1;
+			continue;
+		}
+		fds[fd_count++] = fd;
+	}
+	if (fd_count == 0) {
+		if (transfer_fd(STDIN_FILENO, out_fd) != 0)
+			status = 1;
+		goto finish;
+	}
+	/*
+	 * With one file and pipes on both sides tee() duplicates the input
+	 * pages into the output pipe, and splice() moves the same pages
+	 * into the file. Nothing is copied.
+	 */
+	while (fd_count == 1) {
+		ssize_t size = tee(STDIN_FILENO, out_fd, SHELL_COPY_CHUNK, 0);
+		if (size == 0)
+			goto finish;
+		if (size < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EINVAL)
+				break;
+			status = 1;
+			goto finish;
+		}
+		while (size > 0) {
+			ssize_t rc = splice(STDIN_FILENO, NULL, fds[0], NULL,
+					    size, SPLICE_F_MOVE);
+			if (rc < 0 && errno == EINTR)
+				continue;
+			if (rc <= 0) {
+				status = 1;
+				goto finish;
+			}
+			size -= rc;
+		}
 	}
-	printf("Expressions:\n");
+	char *buf = malloc(SHELL_COPY_BUF_SIZE);
+	while (true) {
+		ssize_t rc = read(STDIN_FILENO, buf, SHELL_COPY_BUF_SIZE);
+		if (rc == 0)
+			break;
+		if (rc < 0) {
+			if (errno == EINTR)
+				continue;
+			status = 1;
+			break;
+		}
+		if (write_all(out_fd, buf, rc) != 0)
+			status = 1;
+		for (uint32_t i = 0; i < fd_count; ++i) {
+			if (write_all(fds[i], buf, rc) != 0)
+				status = 1;
+		}
+	}
+	free(buf);
+finish:
+	for (uint32_t i = 0; i < fd_count; ++i)
+		close(fds[i]);
+	free(fds);
+	return status;
+}
+
+static int
+builtin_jobs(struct shell *sh, const struct command *cmd, int out_fd)
+{
+	(void)cmd;
+	struct job_table *t = &sh->jobs;
+	job_table_reap(t);
+	for (uint32_t i = 0; i < t->capacity; ++i) {
+		if (t->jobs[i].pid == 0)
+			continue;
+		char buf[64];
+		int len = snprintf(buf, sizeof(buf), "[%u] %d Running\n",
+				   t->jobs[i].id, (int)t->jobs[i].pid);
+		if (write_all(out_fd, buf, len) != 0)
+			return 1;
+	}
+	return 0;
+}
+
+static int
+builtin_wait(struct shell *sh, const struct command *cmd, int out_fd)
+{
+	(void)cmd;
+	(void)out_fd;
+	job_table_wait_all(&sh->jobs);
+	return 0;
+}
+
+/** 'hash -r' drops the cached paths, 'hash' prints them. */
+static int
+builtin_hash(struct shell *sh, const struct command *cmd, int out_fd)
+{
+	struct path_cache *c = &sh->path_cache;
+	if (cmd->arg_count > 0 && strcmp(cmd->args[0], "-r") == 0) {
+		path_cache_clear(c);
+		return 0;
+	}
+	for (uint32_t i = 0; i < cmd->arg_count; ++i) {
+		if (path_cache_find(c, cmd->args[i]) == NULL) {
+			fprintf(stderr, "hash: %s: not found\n", cmd->args[i]);
+			return 1;
+		}
+	}
+	if (cmd->arg_count > 0)
+		return 0;
+	for (uint32_t i = 0; i < c->capacity; ++i) {
+		const char *path = c->entries[i].path;
+		if (path == NULL)
+			continue;
+		if (write_all(out_fd, path, strlen(path)) != 0 ||
+		    write_all(out_fd, "\n", 1) != 0)
+			return 1;
+	}
+	return 0;
+}
+
+static const struct builtin builtins[] = {
+	{"cat", builtin_cat, builtin_cat_accepts, true},
+	{"cd", builtin_cd, NULL, false},
+	{"echo", builtin_echo, NULL, false},
+	{"exit", builtin_exit, NULL, false},
+	{"false", builtin_false, NULL, false},
+	{"hash", builtin_hash, NULL, false},
+	{"jobs", builtin_jobs, NULL, false},
+	{"pwd", builtin_pwd, NULL, false},
+	{"tee", builtin_tee, builtin_tee_accepts, true},
+	{"true", builtin_true, NULL, false},
+	{"wait", builtin_wait, NULL, false},
+};
+
+static const struct builtin *
+builtin_find(const struct command *cmd)
+{
+	for (size_t i = 0; i < sizeof(builtins) / sizeof(builtins[0]); ++i) {
+		const struct builtin *b = &builtins[i];
+		if (strcmp(b->name, cmd->exe) != 0)
+			continue;
+		if (b->accepts != NULL && !b->accepts(cmd))
+			return NULL;
+		return b;
+	}
+	return NULL;
+}
+
+static char **
+shell_argv(struct shell *sh, const struct command *cmd)
+{
+	uint32_t count = cmd->arg_count + 2;
+	if (sh->argv_capacity < count) {
+		sh->argv_capacity = count * 2;
+		sh->argv = realloc(sh->argv,
+				   sizeof(*sh->argv) * sh->argv_capacity);
+	}
+	sh->argv[0] = cmd->exe;
+	memcpy(sh->argv + 1, cmd->args, sizeof(*cmd->args) * cmd->arg_count);
+	sh->argv[count - 1] = NULL;
+	return sh->argv;
+}
+
+static int
+wait_status(int status)
+{
+	if (WIFEXITED(status))
+		return WEXITSTATUS(status);
+	if (WIFSIGNALED(status))
+		return 128 + WTERMSIG(status);
+	return 1;
+}
+
+static void
+child_redirect(int in_fd, int out_fd)
+{
+	if (in_fd != STDIN_FILENO)
+		dup2(in_fd, STDIN_FILENO);
+	if (out_fd != STDOUT_FILENO)
+		dup2(out_fd, STDOUT_FILENO);
+}
+
+static pid_t
+launch_fork(struct shell *sh, const struct command *cmd, int in_fd,
+	    int out_fd)
+{
+	const struct builtin *b = builtin_find(cmd);
+	char **argv = NULL;
+	const char *path = NULL;
+	if (b == NULL) {
+		argv = shell_argv(sh, cmd);
+		path = path_cache_find(&sh->path_cache, cmd->exe);
+		if (path == NULL) {
+			fprintf(stderr, "%s: command not found\n", cmd->exe);
+			return -1;
+		}
+	}
+	fflush(stdout);
+	pid_t pid = fork();
+	if (pid != 0) {
+		if (pid < 0)
+			fprintf(stderr, "fork: %s\n", strerror(errno));
+		return pid;
+	}
+	sigprocmask(SIG_SETMASK, &sh->jobs.old_mask, NULL);
+	child_redirect(in_fd, out_fd);
+	if (b != NULL) {
+		/*
+		 * No exec, so O_CLOEXEC won't help. Own copies of the pipe
+		 * ends would keep the neighbours from seeing EOF or EPIPE.
+		 */
+		close_range(3, ~0U, 0);
+		int status = b->func(sh, cmd, STDOUT_FILENO);
+		fflush(stdout);
+		_exit(status);
+	}
+	execv(path, argv);
+	/* The cached path could be stale. */
+	if (errno == ENOENT)
+		execvp(argv[0], argv);
+	fprintf(stderr, "%s: %s\n", argv[0], strerror(errno));
+	_exit(errno == ENOENT ? 127 : 126);
+}
+
+static pid_t
+launch_spawn(struct shell *sh, const struct command *cmd, int in_fd,
+	     int out_fd)
+{
+	/* Builtins inside a pipeline need a process, but not exec. */
+	if (builtin_find(cmd) != NULL)
+		return launch_fork(sh, cmd, in_fd, out_fd);
+	posix_spawn_file_actions_t actions;
+	posix_spawn_file_actions_init(&actions);
+	if (in_fd != STDIN_FILENO)
+		posix_spawn_file_actions_adddup2(&actions, in_fd, STDIN_FILENO);
+	if (out_fd != STDOUT_FILENO)
+		posix_spawn_file_actions_adddup2(&actions, out_fd,
+						 STDOUT_FILENO);
+	char **argv = shell_argv(sh, cmd);
+	/* The child writes to the same stdout, keep the order of the lines. */
+	fflush(stdout);
+	pid_t pid;
+	int rc = ENOENT;
+	for (int attempt = 0; attempt < 2 && rc == ENOENT; ++attempt) {
+		const char *path = path_cache_find(&sh->path_cache, argv[0]);
+		if (path == NULL)
+			break;
+		rc = posix_spawn(&pid, path, &actions, &sh->spawn_attr, argv,
+				 environ);
+		/* The cached path is stale, search again. */
+		if (rc == ENOENT && path != argv[0])
+			path_cache_clear(&sh->path_cache);
+		else
+			break;
+	}
+	posix_spawn_file_actions_destroy(&actions);
+	if (rc == ENOENT) {
+		fprintf(stderr, "%s: command not found\n", argv[0]);
+		return -1;
+	}
+	if (rc != 0) {
+		fprintf(stderr, "%s: %s\n", argv[0], strerror(rc));
+		return -1;
+	}
+	return pid;
+}
+
+static pid_t
+launch(struct shell *sh, const struct command *cmd, int in_fd, int out_fd)
+{
+	if (sh->launcher == LAUNCHER_FORK)
+		return launch_fork(sh, cmd, in_fd, out_fd);
+	return launch_spawn(sh, cmd, in_fd, out_fd);
+}
+
+/**
+ * Execute the commands joined with pipes starting from @a e. The last one
+ * writes into @a out_fd. Returns the first expression after the pipeline.
+ */
+static const struct expr *
+execute_pipeline(struct shell *sh, const struct expr *e, int out_fd,
+		 int *status)
+{
+	assert(e->type == EXPR_TYPE_COMMAND);
+	/*
+	 * A single builtin is executed right in the shell. 'cd' has to
+	 * change the directory of the shell itself, for example.
+	 */
+	if (e->next == NULL || e->next->type != EXPR_TYPE_PIPE) {
+		const struct builtin *b = builtin_find(&e->cmd);
+		if (b != NULL && !b->is_forked_only) {
+			/* The builtins write() past the stdio buffer. */
+			fflush(stdout);
+			*status = b->func(sh, &e->cmd, out_fd);
+			return e->next;
+		}
+	}
+	uint32_t count = 0;
+	int in_fd = STDIN_FILENO;
+	while (true) {
+		bool is_last = e->next == NULL || e->next->type != EXPR_TYPE_PIPE;
+		int pipe_fds[2] = {-1, -1};
+		int cmd_out_fd = out_fd;
+		if (!is_last) {
+			/*
+			 * Close-on-exec, so the children don't keep the pipes
+			 * of each other open. dup2() drops the flag.
+			 */
+			if (pipe2(pipe_fds, O_CLOEXEC) != 0) {
+				fprintf(stderr, "pipe: %s\n", strerror(errno));
+				is_last = true;
+			} else {
+				/*
+				 * Best effort, the kernel can refuse it when
+				 * the user has too much memory in pipes.
+				 */
+				fcntl(pipe_fds[1], F_SETPIPE_SZ, SHELL_PIPE_SIZE);
+				cmd_out_fd = pipe_fds[1];
+			}
+		}
+		if (count == sh->pid_capacity) {
+			sh->pid_capacity = (sh->pid_capacity + 1) * 2;
+			sh->pids = realloc(sh->pids,
+					   sizeof(*sh->pids) * sh->pid_capacity);
+		}
+		sh->pids[count++] = launch(sh, &e->cmd, in_fd, cmd_out_fd);
+		if (in_fd != STDIN_FILENO)
+			close(in_fd);
+		if (pipe_fds[1] >= 0)
+			close(pipe_fds[1]);
+		in_fd = pipe_fds[0];
+		e = e->next;
+		if (is_last)
+			break;
+		assert(e != NULL && e->type == EXPR_TYPE_PIPE);
+		e = e->next;
+	}
+	if (in_fd >= 0 && in_fd != STDIN_FILENO)
+		close(in_fd);
+	/* The rest of the pipeline if it was broken by a pipe() failure. */
+	while (e != NULL && e->type != EXPR_TYPE_AND && e->type != EXPR_TYPE_OR)
+		e = e->next;
+	for (uint32_t i = 0; i < count; ++i) {
+		int st = 127 << 8;
+		if (sh->pids[i] > 0) {
+			while (waitpid(sh->pids[i], &st, 0) < 0 && errno == EINTR)
+				;
+		}
+		if (i + 1 == count)
+			*status = wait_status(st);
+	}
+	return e;
+}
+
+static int
+open_output(const struct command_line *line)
+{
+	if (line->out_type == OUTPUT_TYPE_STDOUT)
+		return STDOUT_FILENO;
+	int flags = O_WRONLY | O_CREAT | O_CLOEXEC;
+	if (line->out_type == OUTPUT_TYPE_FILE_NEW)
+		flags |= O_TRUNC;
+	else
+		flags |= O_APPEND;
+	int fd = open(line->out_file, flags, 0644);
+	if (fd < 0)
+		fprintf(stderr, "%s: %s\n", line->out_file, strerror(errno));
+	return fd;
+}
+
+static int
+execute_command_line_sync(struct shell *sh, const struct command_line *line)
+{
+	int status = 0;
 	const struct expr *e = line->head;
 	while (e != NULL) {
-		if (e->type == EXPR_TYPE_COMMAND) {
-			printf("\tCommand: %s", e->cmd.exe);
-			for (uint32_t i = 0; i < e->cmd.arg_count; ++i)
-				printf(" %s", e->cmd.args[i]);
-			printf("\n");
-		} else if (e->type == EXPR_TYPE_PIPE) {
-			printf("\tPIPE\n");
-		} else if (e->type == EXPR_TYPE_AND) {
-			printf("\tAND\n");
-		} else if (e->type == EXPR_TYPE_OR) {
-			printf("\tOR\n");
-		} else {
-			assert(false);
+		const struct expr *next = e->next;
+		while (next != NULL && next->type != EXPR_TYPE_AND &&
+		       next->type != EXPR_TYPE_OR)
+			next = next->next;
+		/* The redirect belongs to the last pipeline in the line. */
+		int out_fd = STDOUT_FILENO;
+		if (next == NULL) {
+			out_fd = open_output(line);
+			if (out_fd < 0)
+				return 1;
+		}
+		e = execute_pipeline(sh, e, out_fd, &status);
+		if (out_fd != STDOUT_FILENO)
+			close(out_fd);
+		if (sh->is_exit_requested)
+			return status;
+		/* Skip the pipelines not needed by && and ||. */
+		while (e != NULL) {
+			assert(e->type == EXPR_TYPE_AND || e->type == EXPR_TYPE_OR);
+			bool is_and = e->type == EXPR_TYPE_AND;
+			e = e->next;
+			if (is_and == (status == 0))
+				break;
+			while (e != NULL && e->type != EXPR_TYPE_AND &&
+			       e->type != EXPR_TYPE_OR)
+				e = e->next;
 		}
-		e = e->next;
 	}
+	return status;
 }
 
-int
-main(void)
+static void
+execute_command_line(struct shell *sh, const struct command_line *line)
+{
+	assert(line != NULL);
+	if (!line->is_background) {
+		sh->last_status = execute_command_line_sync(sh, line);
+		return;
+	}
+	/* The whole line is executed in a subshell, like bash does. */
+	fflush(stdout);
+	pid_t pid = fork();
+	if (pid < 0) {
+		fprintf(stderr, "fork: %s\n", strerror(errno));
+		sh->last_status = 1;
+		return;
+	}
+	if (pid == 0) {
+		int status = execute_command_line_sync(sh, line);
+		fflush(stdout);
+		_exit(status);
+	}
+	job_table_add(&sh->jobs, pid);
+	sh->last_status = 0;
+}
+
+static void
+shell_execute_parsed(struct shell *sh, struct parser *p)
+{
+	struct command_line *line = NULL;
+	while (!sh->is_exit_requested) {
+		enum parser_error err = parser_pop_next(p, &line);
+		if (err == PARSER_ERR_NONE && line == NULL)
+			break;
+		if (err != PARSER_ERR_NONE) {
+			printf("Error: %d\n", (int)err);
+			continue;
+		}
+		execute_command_line(sh, line);
+		command_line_delete(line);
+		/* Long input batches should not accumulate zombies either. */
+		if (sh->jobs.count > 0)
+			job_table_reap(&sh->jobs);
+	}
+}
+
+/** Interactive mode: read the commands from stdin as they arrive. */
+static void
+shell_execute_stdin(struct shell *sh)
 {
 	const size_t buf_size = 1024;
 	char buf[buf_size];
-	int rc;
 	struct parser *p = parser_new();
-	while ((rc = read(STDIN_FILENO, buf, buf_size)) > 0) {
+	struct pollfd fds[2] = {
+		{.fd = STDIN_FILENO, .events = POLLIN},
+		{.fd = sh->jobs.signal_fd, .events = POLLIN},
+	};
+	while (!sh->is_exit_requested) {
+		if (poll(fds, 2, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			fprintf(stderr, "poll: %s\n", strerror(errno));
+			break;
+		}
+		if (fds[1].revents != 0)
+			job_table_reap(&sh->jobs);
+		if (fds[0].revents == 0)
+			continue;
+		ssize_t rc = read(STDIN_FILENO, buf, buf_size);
+		if (rc < 0 && errno == EINTR)
+			continue;
+		if (rc < 0)
+			break;
+		if (rc == 0) {
+			/* The last line can be without a line end. */
+			parser_feed(p, "\n", 1);
+			shell_execute_parsed(sh, p);
+			break;
+		}
 		parser_feed(p, buf, rc);
-		struct command_line *line = NULL;
-		while (true) {
-			enum parser_error err = parser_pop_next(p, &line);
-			if (err == PARSER_ERR_NONE && line == NULL)
+		shell_execute_parsed(sh, p);
+	}
+	parser_delete(p);
+}
+
+/**
+ * Script mode. The script is mmap-ed and parsed ahead by a helper thread into
+ * a bounded queue of command lines, while the main thread executes them. So
+ * parsing overlaps with starting the commands.
+ */
+enum {
+	/** How many parsed lines the reader can be ahead of the execution. */
+	SCRIPT_QUEUE_SIZE = 1024,
+	/** The script is fed into the parser by pieces of this size. */
+	SCRIPT_FEED_SIZE = 64 * 1024,
+};
+
+struct script_item {
+	struct command_line *line;
+	enum parser_error error;
+};
+
+struct script_queue {
+	const char *data;
+	size_t size;
+	struct script_item items[SCRIPT_QUEUE_SIZE];
+	/** Index of the first item to pop. */
+	uint32_t head;
+	uint32_t count;
+	/** The reader has parsed the whole script. */
+	bool is_finished;
+	/** The executor stopped, for example, by 'exit'. */
+	bool is_cancelled;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond_not_empty;
+	pthread_cond_t cond_not_full;
+};
+
+/** Returns false when the queue is cancelled. */
+static bool
+script_queue_push(struct script_queue *q, struct script_item item)
+{
+	pthread_mutex_lock(&q->mutex);
+	while (q->count == SCRIPT_QUEUE_SIZE && !q->is_cancelled)
+		pthread_cond_wait(&q->cond_not_full, &q->mutex);
+	bool ok = !q->is_cancelled;
+	if (ok) {
+		q->items[(q->head + q->count) % SCRIPT_QUEUE_SIZE] = item;
+		if (q->count++ == 0)
+			pthread_cond_signal(&q->cond_not_empty);
+	}
+	pthread_mutex_unlock(&q->mutex);
+	return ok;
+}
+
+/** Returns false when the whole script is executed. */
+static bool
+script_queue_pop(struct script_queue *q, struct script_item *item)
+{
+	pthread_mutex_lock(&q->mutex);
+	while (q->count == 0 && !q->is_finished)
+		pthread_cond_wait(&q->cond_not_empty, &q->mutex);
+	bool ok = q->count > 0;
+	if (ok) {
+		*item = q->items[q->head];
+		q->head = (q->head + 1) % SCRIPT_QUEUE_SIZE;
+		if (q->count-- == SCRIPT_QUEUE_SIZE)
+			pthread_cond_signal(&q->cond_not_full);
+	}
+	pthread_mutex_unlock(&q->mutex);
+	return ok;
+}
+
+static void *
+script_reader_f(void *arg)
+{
+	struct script_queue *q = arg;
+	struct parser *p = parser_new();
+	size_t pos = 0;
+	bool is_eof = false;
+	bool ok = true;
+	while (ok && !is_eof) {
+		if (pos < q->size) {
+			size_t size = q->size - pos;
+			if (size > SCRIPT_FEED_SIZE)
+				size = SCRIPT_FEED_SIZE;
+			parser_feed(p, q->data + pos, size);
+			pos += size;
+		} else {
+			/* The last line can be without a line end. */
+			parser_feed(p, "\n", 1);
+			is_eof = true;
+		}
+		while (ok) {
+			struct script_item item;
+			item.error = parser_pop_next(p, &item.line);
+			if (item.error == PARSER_ERR_NONE && item.line == NULL)
 				break;
-			if (err != PARSER_ERR_NONE) {
-				printf("Error: %d\n", (int)err);
-				continue;
-			}
-			execute_command_line(line);
-			command_line_delete(line);
+			ok = script_queue_push(q, item);
+			if (!ok && item.line != NULL)
+				command_line_delete(item.line);
 		}
 	}
 	parser_delete(p);
+	pthread_mutex_lock(&q->mutex);
+	q->is_finished = true;
+	pthread_cond_signal(&q->cond_not_empty);
+	pthread_mutex_unlock(&q->mutex);
+	return NULL;
+}
+
+static int
+shell_execute_script(struct shell *sh, const char *path)
+{
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		fprintf(stderr, "%s: %s\n", path, strerror(errno));
+		return -1;
+	}
+	struct stat st;
+	if (fstat(fd, &st) != 0) {
+		fprintf(stderr, "%s: %s\n", path, strerror(errno));
+		close(fd);
+		return -1;
+	}
+	struct script_queue *q = calloc(1, sizeof(*q));
+	q->size = st.st_size;
+	/* mmap() does not accept empty mappings. */
+	if (q->size > 0) {
+		void *data = mmap(NULL, q->size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (data == MAP_FAILED) {
+			fprintf(stderr, "mmap: %s\n", strerror(errno));
+			close(fd);
+			free(q);
+			return -1;
+		}
+		madvise(data, q->size, MADV_SEQUENTIAL);
+		q->data = data;
+	}
+	close(fd);
+	pthread_mutex_init(&q->mutex, NULL);
+	pthread_cond_init(&q->cond_not_empty, NULL);
+	pthread_cond_init(&q->cond_not_full, NULL);
+	pthread_t reader;
+	int rc = pthread_create(&reader, NULL, script_reader_f, q);
+	if (rc != 0) {
+		fprintf(stderr, "pthread_create: %s\n", strerror(rc));
+		q->is_finished = true;
+	}
+
+	struct script_item item;
+	while (!sh->is_exit_requested && script_queue_pop(q, &item)) {
+		if (item.error != PARSER_ERR_NONE) {
+			printf("Error: %d\n", (int)item.error);
+			continue;
+		}
+		execute_command_line(sh, item.line);
+		command_line_delete(item.line);
+		if (sh->jobs.count > 0)
+			job_table_reap(&sh->jobs);
+	}
+
+	pthread_mutex_lock(&q->mutex);
+	q->is_cancelled = true;
+	pthread_cond_signal(&q->cond_not_full);
+	pthread_mutex_unlock(&q->mutex);
+	if (rc == 0)
+		pthread_join(reader, NULL);
+	for (; q->count > 0; --q->count) {
+		struct script_item *i = &q->items[q->head];
+		if (i->line != NULL)
+			command_line_delete(i->line);
+		q->head = (q->head + 1) % SCRIPT_QUEUE_SIZE;
+	}
+	pthread_cond_destroy(&q->cond_not_full);
+	pthread_cond_destroy(&q->cond_not_empty);
+	pthread_mutex_destroy(&q->mutex);
+	if (q->size > 0)
+		munmap((void *)q->data, q->size);
+	free(q);
 	return 0;
 }
+
+/**
+ * Server mode. The shell listens on a UNIX socket and executes the command
+ * lines sent by many clients at once, so the tools don't pay the shell start
+ * for each batch of commands. Each client has its own parser. Its lines are
+ * executed one by one, each in a runner process forked from the server with
+ * stdout and stderr going right into the client socket. Different clients
+ * are served in parallel. The runners inherit the warm path cache of the
+ * server.
+ *
+ * A client closes its sending side when done and gets the socket closed by
+ * the server after the output of the last line. The current directory is
+ * kept per client, 'exit' ends the session.
+ */
+enum {
+	SERVER_READ_SIZE = 64 * 1024,
+	SERVER_MAX_EVENTS = 64,
+	SERVER_BACKLOG = 128,
+};
+
+struct client {
+	int fd;
+	struct parser *parser;
+	/** Directory for the commands of this client. */
+	int cwd_fd;
+	/** The process executing the current line, or 0. */
+	pid_t runner;
+	/** The client won't send anything more. */
+	bool is_eof;
+	/** The client is gone or has said 'exit', drop its commands. */
+	bool is_closed;
+	/** Input is read only while the client has nothing to execute. */
+	bool is_reading;
+	/**
+	 * The client is done, but is freed only after the current batch of
+	 * events, which can still have events of it.
+	 */
+	bool is_dead;
+	struct client *next_dead;
+};
+
+struct server {
+	int listen_fd;
+	int epoll_fd;
+	struct client **clients;
+	uint32_t client_count;
+	uint32_t client_capacity;
+	struct client *dead;
+};
+
+/** Messages of the server itself, they must never block it. */
+static void
+client_printf(struct client *c, const char *format, ...)
+	__attribute__((format(printf, 2, 3)));
+
+static void
+client_printf(struct client *c, const char *format, ...)
+{
+	char buf[512];
+	va_list args;
+	va_start(args, format);
+	int len = vsnprintf(buf, sizeof(buf), format, args);
+	va_end(args);
+	if (len >= (int)sizeof(buf))
+		len = sizeof(buf) - 1;
+	send(c->fd, buf, len, MSG_DONTWAIT | MSG_NOSIGNAL);
+}
+
+static void
+client_close(struct server *srv, struct client *c)
+{
+	for (uint32_t i = 0; i < srv->client_count; ++i) {
+		if (srv->clients[i] == c) {
+			srv->clients[i] = srv->clients[--srv->client_count];
+			break;
+		}
+	}
+	close(c->fd);
+	close(c->cwd_fd);
+	parser_delete(c->parser);
+	c->is_dead = true;
+	c->next_dead = srv->dead;
+	srv->dead = c;
+}
+
+static void
+server_free_dead(struct server *srv)
+{
+	while (srv->dead != NULL) {
+		struct client *c = srv->dead;
+		srv->dead = c->next_dead;
+		free(c);
+	}
+}
+
+static void
+client_set_reading(struct server *srv, struct client *c, bool is_reading)
+{
+	if (c->is_reading == is_reading)
+		return;
+	/*
+	 * Not reading a busy client keeps its not executed input in the
+	 * socket, so a fast sender is slowed down by the socket buffer.
+	 */
+	struct epoll_event ev;
+	ev.events = is_reading ? EPOLLIN : 0;
+	ev.data.ptr = c;
+	epoll_ctl(srv->epoll_fd, EPOLL_CTL_MOD, c->fd, &ev);
+	c->is_reading = is_reading;
+}
+
+/**
+ * 'cd' and 'exit' alone in a line change the client session, so they are
+ * done by the server. Returns true if the line was such a command.
+ */
+static bool
+client_execute_session_builtin(struct client *c,
+			       const struct command_line *line)
+{
+	const struct expr *e = line->head;
+	if (line->is_background || line->out_type != OUTPUT_TYPE_STDOUT ||
+	    e->next != NULL)
+		return false;
+	assert(e->type == EXPR_TYPE_COMMAND);
+	const struct command *cmd = &e->cmd;
+	if (strcmp(cmd->exe, "exit") == 0) {
+		c->is_closed = true;
+		return true;
+	}
+	if (strcmp(cmd->exe, "cd") != 0)
+		return false;
+	const char *dir = cmd->arg_count > 0 ? cmd->args[0] : getenv("HOME");
+	if (dir == NULL) {
+		client_printf(c, "cd: HOME not set\n");
+		return true;
+	}
+	int fd = openat(c->cwd_fd, dir, O_PATH | O_DIRECTORY | O_CLOEXEC);
+	if (fd < 0) {
+		client_printf(c, "cd: %s: %s\n", dir, strerror(errno));
+		return true;
+	}
+	close(c->cwd_fd);
+	c->cwd_fd = fd;
+	return true;
+}
+
+static pid_t
+client_start_runner(struct shell *sh, struct server *srv, struct client *c,
+		    const struct command_line *line)
+{
+	/* Look the commands up once here, then all the runners have them. */
+	for (const struct expr *e = line->head; e != NULL; e = e->next) {
+		if (e->type == EXPR_TYPE_COMMAND && builtin_find(&e->cmd) == NULL)
+			path_cache_find(&sh->path_cache, e->cmd.exe);
+	}
+	fflush(stdout);
+	fflush(stderr);
+	pid_t pid = fork();
+	if (pid != 0) {
+		if (pid < 0)
+			client_printf(c, "fork: %s\n", strerror(errno));
+		return pid;
+	}
+	close(srv->listen_fd);
+	close(srv->epoll_fd);
+	/*
+	 * Copies of the other sockets would keep them open after the server
+	 * closes them, and their clients would wait for this line to end.
+	 */
+	for (uint32_t i = 0; i < srv->client_count; ++i) {
+		if (srv->clients[i] != c)
+			close(srv->clients[i]->fd);
+	}
+	int null_fd = open("/dev/null", O_RDONLY);
+	if (null_fd >= 0) {
+		dup2(null_fd, STDIN_FILENO);
+		close(null_fd);
+	}
+	dup2(c->fd, STDOUT_FILENO);
+	dup2(c->fd, STDERR_FILENO);
+	if (fchdir(c->cwd_fd) != 0) {
+		fprintf(stderr, "cd: %s\n", strerror(errno));
+		_exit(1);
+	}
+	execute_command_line(sh, line);
+	fflush(stdout);
+	fflush(stderr);
+	_exit(sh->last_status);
+}
+
+/** Start the next line of the client if it is idle and has one. */
+static void
+client_advance(struct shell *sh, struct server *srv, struct client *c)
+{
+	while (c->runner == 0 && !c->is_closed) {
+		struct command_line *line = NULL;
+		enum parser_error err = parser_pop_next(c->parser, &line);
+		if (err != PARSER_ERR_NONE) {
+			client_printf(c, "Error: %d\n", (int)err);
+			continue;
+		}
+		if (line == NULL)
+			break;
+		if (!client_execute_session_builtin(c, line)) {
+			pid_t pid = client_start_runner(sh, srv, c, line);
+			if (pid > 0)
+				c->runner = pid;
+		}
+		command_line_delete(line);
+	}
+	if (c->runner == 0 && (c->is_eof || c->is_closed)) {
+		client_close(srv, c);
+		return;
+	}
+	if (!c->is_eof)
+		client_set_reading(srv, c, c->runner == 0);
+}
+
+static void
+client_read(struct shell *sh, struct server *srv, struct client *c,
+	    uint32_t events)
+{
+	char buf[SERVER_READ_SIZE];
+	ssize_t rc = read(c->fd, buf, sizeof(buf));
+	if (rc < 0 && (errno == EINTR || errno == EAGAIN))
+		return;
+	if (rc > 0) {
+		parser_feed(c->parser, buf, rc);
+	} else {
+		/* The last line can be without a line end. */
+		parser_feed(c->parser, "\n", 1);
+		c->is_eof = true;
+		if (rc < 0 || (events & (EPOLLHUP | EPOLLERR)) != 0)
+			c->is_closed = true;
+		/* Otherwise a hung up socket would wake up the loop forever. */
+		epoll_ctl(srv->epoll_fd, EPOLL_CTL_DEL, c->fd, NULL);
+		c->is_reading = false;
+	}
+	client_advance(sh, srv, c);
+}
+
+static void
+server_accept(struct server *srv)
+{
+	int fd = accept4(srv->listen_fd, NULL, NULL, SOCK_CLOEXEC);
+	if (fd < 0) {
+		if (errno != EAGAIN && errno != EINTR)
+			fprintf(stderr, "accept: %s\n", strerror(errno));
+		return;
+	}
+	struct client *c = calloc(1, sizeof(*c));
+	c->fd = fd;
+	c->parser = parser_new();
+	c->cwd_fd = open(".", O_PATH | O_DIRECTORY | O_CLOEXEC);
+	c->is_reading = true;
+	struct epoll_event ev;
+	ev.events = EPOLLIN;
+	ev.data.ptr = c;
+	if (c->cwd_fd < 0 ||
+	    epoll_ctl(srv->epoll_fd, EPOLL_CTL_ADD, fd, &ev) != 0) {
+		fprintf(stderr, "client: %s\n", strerror(errno));
+		close(fd);
+		if (c->cwd_fd >= 0)
+			close(c->cwd_fd);
+		parser_delete(c->parser);
+		free(c);
+		return;
+	}
+	if (srv->client_count == srv->client_capacity) {
+		srv->client_capacity = (srv->client_capacity + 1) * 2;
+		srv->clients = realloc(srv->clients, sizeof(*srv->clients) *
+				       srv->client_capacity);
+	}
+	srv->clients[srv->client_count++] = c;
+}
+
+/** Collect the finished runners and move their clients forward. */
+static void
+server_reap(struct shell *sh, struct server *srv)
+{
+	struct signalfd_siginfo info;
+	while (read(sh->jobs.signal_fd, &info, sizeof(info)) > 0)
+		;
+	pid_t pid;
+	while ((pid = waitpid(-1, NULL, WNOHANG)) > 0) {
+		for (uint32_t i = 0; i < srv->client_count; ++i) {
+			struct client *c = srv->clients[i];
+			if (c->runner != pid)
+				continue;
+			c->runner = 0;
+			client_advance(sh, srv, c);
+			break;
+		}
+	}
+}
+
+static int
+server_listen(struct server *srv, const char *path)
+{
+	struct sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		fprintf(stderr, "%s: too long socket path\n", path);
+		return -1;
+	}
+	strcpy(addr.sun_path, path);
+	srv->listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK |
+				SOCK_CLOEXEC, 0);
+	if (srv->listen_fd < 0) {
+		fprintf(stderr, "socket: %s\n", strerror(errno));
+		return -1;
+	}
+	/* A socket file left by a previous server. */
+	unlink(path);
+	if (bind(srv->listen_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+	    listen(srv->listen_fd, SERVER_BACKLOG) != 0) {
+		fprintf(stderr, "%s: %s\n", path, strerror(errno));
+		close(srv->listen_fd);
+		return -1;
+	}
+	return 0;
+}
+
+static int
+shell_serve(struct shell *sh, const char *path)
+{
+	struct server srv;
+	memset(&srv, 0, sizeof(srv));
+	if (server_listen(&srv, path) != 0)
+		return -1;
+	srv.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	struct epoll_event ev;
+	ev.events = EPOLLIN;
+	ev.data.ptr = &srv.listen_fd;
+	epoll_ctl(srv.epoll_fd, EPOLL_CTL_ADD, srv.listen_fd, &ev);
+	ev.data.ptr = &sh->jobs.signal_fd;
+	epoll_ctl(srv.epoll_fd, EPOLL_CTL_ADD, sh->jobs.signal_fd, &ev);
+
+	struct epoll_event events[SERVER_MAX_EVENTS];
+	while (true) {
+		int count = epoll_wait(srv.epoll_fd, events, SERVER_MAX_EVENTS,
+				       -1);
+		if (count < 0) {
+			if (errno == EINTR)
+				continue;
+			fprintf(stderr, "epoll_wait: %s\n", strerror(errno));
+			break;
+		}
+		for (int i = 0; i < count; ++i) {
+			void *ptr = events[i].data.ptr;
+			if (ptr == &srv.listen_fd)
+				server_accept(&srv);
+			else if (ptr == &sh->jobs.signal_fd)
+				server_reap(sh, &srv);
+			else if (!((struct client *)ptr)->is_dead)
+				client_read(sh, &srv, ptr, events[i].events);
+		}
+		server_free_dead(&srv);
+	}
+	while (srv.client_count > 0)
+		client_close(&srv, srv.clients[0]);
+	server_free_dead(&srv);
+	free(srv.clients);
+	close(srv.epoll_fd);
+	close(srv.listen_fd);
+	unlink(path);
+	return -1;
+}
+
+int
+main(int argc, char **argv)
+{
+	struct shell sh;
+	memset(&sh, 0, sizeof(sh));
+	sh.launcher = LAUNCHER_SPAWN;
+	const char *socket_path = NULL;
+	int opt;
+	while ((opt = getopt(argc, argv, "l:s:")) != -1) {
+		if (opt == 's') {
+			socket_path = optarg;
+		} else if (opt == 'l' && strcmp(optarg, "fork") == 0) {
+			sh.launcher = LAUNCHER_FORK;
+		} else if (opt == 'l' && strcmp(optarg, "spawn") == 0) {
+			sh.launcher = LAUNCHER_SPAWN;
+		} else {
+			fprintf(stderr, "Usage: %s [-l fork|spawn] "
+				"[-s socket | script]\n", argv[0]);
+			return 1;
+		}
+	}
+	if (job_table_create(&sh.jobs) != 0) {
+		fprintf(stderr, "signalfd: %s\n", strerror(errno));
+		return 1;
+	}
+	posix_spawnattr_init(&sh.spawn_attr);
+	posix_spawnattr_setsigmask(&sh.spawn_attr, &sh.jobs.old_mask);
+	posix_spawnattr_setflags(&sh.spawn_attr, POSIX_SPAWN_SETSIGMASK);
+
+	if (socket_path != NULL) {
+		if (shell_serve(&sh, socket_path) != 0)
+			sh.last_status = 1;
+	} else if (optind < argc) {
+		if (shell_execute_script(&sh, argv[optind]) != 0)
+			sh.last_status = 127;
+	} else {
+		shell_execute_stdin(&sh);
+	}
+
+	free(sh.argv);
+	free(sh.pids);
+	path_cache_clear(&sh.path_cache);
+	job_table_destroy(&sh.jobs);
+	posix_spawnattr_destroy(&sh.spawn_attr);
+	return sh.last_status;
+}
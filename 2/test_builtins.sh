@@ -0,0 +1,29 @@
+#!/bin/sh
+# Checks of the cat and tee builtins which the course checker doesn't cover.
+# A builtin in a pipeline is a forked process without exec. It must see its
+# reader exit, so each case runs under a timeout. Usage: ./test_builtins.sh [shell]
+
+shell=${1:-./solution}
+failed=0
+
+check() {
+	expected=$1
+	actual=$(printf '%s\n' "$2" | timeout 5 "$shell" 2>&1)
+	rc=$?
+	if [ $rc -eq 0 ] && [ "$actual" = "$expected" ]; then
+		echo "ok - $2"
+	else
+		echo "not ok - $2"
+		echo "expected: $expected"
+		echo "actual: $actual, exit code $rc"
+		failed=1
+	fi
+}
+
+check "10" "cat /dev/zero | head -c 10 | wc -c | tr -d [:blank:]"
+check "10" "cat /dev/zero | tee /dev/null | head -c 10 | wc -c | tr -d [:blank:]"
+check "abc" "echo abc | cat"
+check "abc
+abc" "echo abc | tee /dev/stdout | cat"
+
+exit $failed
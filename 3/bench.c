@@ -0,0 +1,187 @@
+#include "userfs.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/**
+ * I/O speed of one big file of the maximal size. The file is written and
+ * read sequentially by chunks of different sizes. Small chunks show the
+ * cost of finding the block for each call deep in a big file. The reading is
+ * done twice: with copying and with zero-copy views.
+ *
+ * A resize of an empty file to the maximal size should take no time, the new
+ * space is a hole. A clone of a full file of the maximal size should take no
+ * time either, the data is shared.
+ *
+ * Then a few big files are saved into an image and loaded back. The load
+ * should take about the same time regardless of the data size.
+ *
+ * $> ./bench
+ */
+
+enum {
+	BENCH_FILE_SIZE = 100 * 1024 * 1024,
+	BENCH_IMAGE_FILE_COUNT = 4,
+};
+
+static double
+now_sec(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void
+check(bool ok, const char *what)
+{
+	if (ok)
+		return;
+	printf("%s failed, error %d\n", what, (int)ufs_errno());
+	exit(1);
+}
+
+static void
+bench_sequential(char *buf, size_t chunk_size)
+{
+	int fd = ufs_open("file", UFS_CREATE);
+	check(fd != -1, "open");
+	double start = now_sec();
+	for (size_t done = 0; done < BENCH_FILE_SIZE; done += chunk_size)
+		check(ufs_write(fd, buf, chunk_size) == (ssize_t)chunk_size,
+		      "write");
+	double write_time = now_sec() - start;
+	check(ufs_close(fd) == 0, "close");
+
+	fd = ufs_open("file", 0);
+	check(fd != -1, "open");
+	start = now_sec();
+	for (size_t done = 0; done < BENCH_FILE_SIZE; done += chunk_size)
+		check(ufs_read(fd, buf, chunk_size) == (ssize_t)chunk_size,
+		      "read");
+	double read_time = now_sec() - start;
+	check(ufs_close(fd) == 0, "close");
+
+	fd = ufs_open("file", 0);
+	check(fd != -1, "open");
+	start = now_sec();
+	for (size_t done = 0; done < BENCH_FILE_SIZE; done += chunk_size) {
+		struct iovec *iov;
+		int iovcnt;
+		check(ufs_read_view(fd, chunk_size, &iov, &iovcnt) ==
+		      (ssize_t)chunk_size, "read view");
+		/* Touch each view, otherwise nothing is read at all. */
+		for (int i = 0; i < iovcnt; ++i)
+			check(*(char *)iov[i].iov_base == 'x', "view data");
+		ufs_release_view(iov, iovcnt);
+	}
+	double view_time = now_sec() - start;
+	check(ufs_close(fd) == 0, "close");
+	check(ufs_delete("file") == 0, "delete");
+
+	double mb = BENCH_FILE_SIZE / (1024.0 * 1024);
+	printf("sequential chunk %8zu: write %8.1f MB/sec, read %8.1f MB/sec, "
+	       "view %9.1f MB/sec\n", chunk_size, mb / write_time,
+	       mb / read_time, mb / view_time);
+}
+
+static void
+bench_resize(void)
+{
+	int fd = ufs_open("file", UFS_CREATE);
+	check(fd != -1, "open");
+	double start = now_sec();
+	check(ufs_resize(fd, BENCH_FILE_SIZE) == 0, "resize");
+	double duration = now_sec() - start;
+	check(ufs_close(fd) == 0, "close");
+	check(ufs_delete("file") == 0, "delete");
+	printf("resize to %d MB: %8.3f ms\n", BENCH_FILE_SIZE / (1024 * 1024),
+	       duration * 1000);
+}
+
+static void
+bench_clone(char *buf)
+{
+	int fd = ufs_open("file", UFS_CREATE);
+	check(fd != -1, "open");
+	for (size_t done = 0; done < BENCH_FILE_SIZE; done += 1024 * 1024)
+		check(ufs_write(fd, buf, 1024 * 1024) == 1024 * 1024, "write");
+	check(ufs_close(fd) == 0, "close");
+	double start = now_sec();
+	check(ufs_clone("file", "copy") == 0, "clone");
+	double duration = now_sec() - start;
+	check(ufs_delete("copy") == 0, "delete");
+	check(ufs_delete("file") == 0, "delete");
+	printf("clone of %d MB: %8.3f ms\n", BENCH_FILE_SIZE / (1024 * 1024),
+	       duration * 1000);
+}
+
+static void
+bench_image(char *buf)
+{
+	const char *path = "bench_image.ufs";
+	for (int i = 0; i < BENCH_IMAGE_FILE_COUNT; ++i) {
+		char name[32];
+		sprintf(name, "image%d", i);
+		int fd = ufs_open(name, UFS_CREATE);
+		check(fd != -1, "open");
+		for (size_t done = 0; done < BENCH_FILE_SIZE;
+		     done += 1024 * 1024) {
+			check(ufs_write(fd, buf, 1024 * 1024) == 1024 * 1024,
+			      "write");
+		}
+		check(ufs_close(fd) == 0, "close");
+	}
+	double start = now_sec();
+	check(ufs_snapshot(path) == 0, "snapshot");
+	double snapshot_time = now_sec() - start;
+	for (int i = 0; i < BENCH_IMAGE_FILE_COUNT; ++i) {
+		char name[32];
+		sprintf(name, "image%d", i);
+		check(ufs_delete(name) == 0, "delete");
+	}
+	start = now_sec();
+	check(ufs_load(path) == 0, "load");
+	double load_time = now_sec() - start;
+	start = now_sec();
+	for (int i = 0; i < BENCH_IMAGE_FILE_COUNT; ++i) {
+		char name[32];
+		sprintf(name, "image%d", i);
+		int fd = ufs_open(name, 0);
+		check(fd != -1, "open");
+		for (size_t done = 0; done < BENCH_FILE_SIZE;
+		     done += 1024 * 1024) {
+			check(ufs_read(fd, buf, 1024 * 1024) == 1024 * 1024,
+			      "read");
+		}
+		check(ufs_close(fd) == 0, "close");
+		check(ufs_delete(name) == 0, "delete");
+	}
+	double read_time = now_sec() - start;
+	unlink(path);
+
+	double mb = BENCH_FILE_SIZE / (1024.0 * 1024) * BENCH_IMAGE_FILE_COUNT;
+	printf("image %.0f MB: snapshot %8.1f MB/sec, load %8.3f ms, "
+	       "first read %8.1f MB/sec\n", mb, mb / snapshot_time,
+	       load_time * 1000, mb / read_time);
+}
+
+int
+main(void)
+{
+	const size_t chunk_sizes[] = {64, 512, 4096, 65536, 1024 * 1024};
+	char *buf = malloc(1024 * 1024);
+	memset(buf, 'x', 1024 * 1024);
+	for (size_t i = 0; i < sizeof(chunk_sizes) / sizeof(chunk_sizes[0]); ++i)
+		bench_sequential(buf, chunk_sizes[i]);
+	bench_resize();
+	bench_clone(buf);
+	bench_image(buf);
+	free(buf);
+	ufs_destroy();
+	return 0;
+}
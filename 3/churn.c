@@ -0,0 +1,125 @@
+#include "userfs.h"
+
+#ifdef HEAP_HELP
+#include "heap_help/heap_help.h"
+#endif
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/**
+ * Churn of small files: each operation creates a file, writes a few bytes or
+ * kilobytes into it, reads them back, closes and deletes it. It is the worst
+ * case for the allocator, everything allocated by an operation is freed right
+ * away.
+ *
+ * Built with -DHEAP_HELP it also counts the malloc calls per operation. Then
+ * the speed is mostly the speed of heap_help.
+ *
+ * $> ./churn [max thread count]
+ */
+
+enum {
+	CHURN_OP_COUNT = 200000,
+	CHURN_MAX_WRITE_SIZE = 8192,
+	CHURN_TINY_WRITE_SIZE = 100,
+};
+
+static double
+now_sec(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void
+check(bool ok, const char *what)
+{
+	if (ok)
+		return;
+	printf("%s failed, error %d\n", what, (int)ufs_errno());
+	exit(1);
+}
+
+struct worker {
+	pthread_t thread;
+	int id;
+	int op_count;
+	size_t max_size;
+};
+
+static void *
+worker_f(void *arg)
+{
+	struct worker *w = arg;
+	char buf[CHURN_MAX_WRITE_SIZE];
+	char in[CHURN_MAX_WRITE_SIZE];
+	memset(buf, 'x', sizeof(buf));
+	uint32_t rng = w->id * 2654435761u + 1;
+	char name[32];
+	sprintf(name, "churn%d", w->id);
+	for (int i = 0; i < w->op_count; ++i) {
+		rng = rng * 1103515245 + 12345;
+		size_t size = 1 + (rng >> 8) % w->max_size;
+		int fd = ufs_open(name, UFS_CREATE);
+		check(fd != -1, "open");
+		check(ufs_write(fd, buf, size) == (ssize_t)size, "write");
+		check(ufs_pread(fd, in, size, 0) == (ssize_t)size, "read");
+		check(ufs_close(fd) == 0, "close");
+		check(ufs_delete(name) == 0, "delete");
+	}
+	return NULL;
+}
+
+static void
+churn(int thread_count, size_t max_size)
+{
+	struct worker *workers = calloc(thread_count, sizeof(*workers));
+#ifdef HEAP_HELP
+	uint64_t allocs = heaph_get_alloc_count_total();
+#endif
+	double start = now_sec();
+	for (int i = 0; i < thread_count; ++i) {
+		workers[i].id = i;
+		workers[i].op_count = CHURN_OP_COUNT / thread_count;
+		workers[i].max_size = max_size;
+		pthread_create(&workers[i].thread, NULL, worker_f, &workers[i]);
+	}
+	for (int i = 0; i < thread_count; ++i)
+		pthread_join(workers[i].thread, NULL);
+	double duration = now_sec() - start;
+	int op_count = CHURN_OP_COUNT / thread_count * thread_count;
+	printf("churn %4zu bytes, %2d threads: %10.0f ops/sec", max_size,
+	       thread_count, op_count / duration);
+#ifdef HEAP_HELP
+	/* The thread stacks and the workers are not the operations. */
+	allocs = heaph_get_alloc_count_total() - allocs - thread_count - 1;
+	printf(", %5.2f mallocs/op", (double)allocs / op_count);
+#endif
+	printf("\n");
+	free(workers);
+}
+
+int
+main(int argc, char **argv)
+{
+	int max_threads = 4;
+	if (argc > 1)
+		max_threads = atoi(argv[1]);
+	if (max_threads <= 0) {
+		fprintf(stderr, "Usage: %s [max thread count]\n", argv[0]);
+		return 1;
+	}
+	for (int count = 1; count <= max_threads; count *= 2) {
+		churn(count, CHURN_TINY_WRITE_SIZE);
+		churn(count, CHURN_MAX_WRITE_SIZE);
+	}
+	ufs_destroy();
+	return 0;
+}
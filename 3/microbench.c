@@ -0,0 +1,326 @@
+#include "userfs.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/**
+ * Throughput and latency of each userfs operation at different thread
+ * counts. Each thread works with its own file, so the numbers show the cost
+ * of the operation itself plus the contention on the global state. One line
+ * per operation, size and thread count, in CSV:
+ *
+ *     op,size,threads,ops,ops_per_sec,p50_ns,p99_ns
+ *
+ * The size is the size of each read or write, or 0 for the operations
+ * without any. The latencies are of single calls, the throughput is of all
+ * the threads together. Delete needs a new file with descriptors for each
+ * call, so its throughput includes creating them.
+ *
+ * $> ./microbench [max thread count]
+ */
+
+enum {
+	BENCH_FILE_SIZE = 16 * 1024 * 1024,
+	BENCH_MAX_IO_SIZE = 1024 * 1024,
+	/** Each thread moves so many bytes per operation and size. */
+	BENCH_BYTES = 256 * 1024 * 1024,
+	BENCH_MIN_OPS = 100,
+	BENCH_MAX_OPS = 100000,
+	BENCH_DELETE_DESC_COUNT = 4,
+};
+
+static uint64_t
+now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void
+check(bool ok, const char *what)
+{
+	if (ok)
+		return;
+	fprintf(stderr, "%s failed, error %d\n", what, (int)ufs_errno());
+	exit(1);
+}
+
+struct worker {
+	pthread_t thread;
+	const struct bench_op *op;
+	pthread_barrier_t *barrier;
+	char name[32];
+	int fd;
+	size_t size;
+	char *buf;
+	uint64_t rng;
+	int op_count;
+	uint64_t *latencies;
+	uint64_t start;
+	uint64_t end;
+};
+
+static uint64_t
+rng_next(struct worker *w)
+{
+	w->rng ^= w->rng << 13;
+	w->rng ^= w->rng >> 7;
+	w->rng ^= w->rng << 17;
+	return w->rng;
+}
+
+/** Offset of the i-th operation: sequential or random, within the file. */
+static size_t
+io_offset(struct worker *w, int i, bool is_random)
+{
+	size_t slot_count = BENCH_FILE_SIZE / w->size;
+	size_t slot = is_random ? rng_next(w) % slot_count : i % slot_count;
+	return slot * w->size;
+}
+
+static void
+setup_file(struct worker *w)
+{
+	w->fd = ufs_open(w->name, UFS_CREATE);
+	check(w->fd != -1, "open");
+	for (size_t done = 0; done < BENCH_FILE_SIZE;
+	     done += BENCH_MAX_IO_SIZE) {
+		check(ufs_write(w->fd, w->buf, BENCH_MAX_IO_SIZE) ==
+		      BENCH_MAX_IO_SIZE, "write");
+	}
+}
+
+static void
+teardown_file(struct worker *w)
+{
+	check(ufs_close(w->fd) == 0, "close");
+	check(ufs_delete(w->name) == 0, "delete");
+}
+
+static void
+setup_empty_file(struct worker *w)
+{
+	w->fd = ufs_open(w->name, UFS_CREATE);
+	check(w->fd != -1, "open");
+}
+
+static void
+setup_none(struct worker *w)
+{
+	(void)w;
+}
+
+static void
+teardown_none(struct worker *w)
+{
+	(void)w;
+}
+
+static uint64_t
+run_open_close(struct worker *w, int i)
+{
+	(void)i;
+	uint64_t start = now_ns();
+	int fd = ufs_open(w->name, UFS_CREATE);
+	check(fd != -1, "open");
+	check(ufs_close(fd) == 0, "close");
+	return now_ns() - start;
+}
+
+static void
+teardown_open_close(struct worker *w)
+{
+	check(ufs_delete(w->name) == 0, "delete");
+}
+
+static uint64_t
+run_io(struct worker *w, int i, bool is_random, bool is_write)
+{
+	size_t offset = io_offset(w, i, is_random);
+	uint64_t start = now_ns();
+	ssize_t rc = is_write ? ufs_pwrite(w->fd, w->buf, w->size, offset) :
+		     ufs_pread(w->fd, w->buf, w->size, offset);
+	uint64_t end = now_ns();
+	check(rc == (ssize_t)w->size, is_write ? "write" : "read");
+	return end - start;
+}
+
+static uint64_t
+run_seq_read(struct worker *w, int i)
+{
+	return run_io(w, i, false, false);
+}
+
+static uint64_t
+run_seq_write(struct worker *w, int i)
+{
+	return run_io(w, i, false, true);
+}
+
+static uint64_t
+run_rand_read(struct worker *w, int i)
+{
+	return run_io(w, i, true, false);
+}
+
+static uint64_t
+run_rand_write(struct worker *w, int i)
+{
+	return run_io(w, i, true, true);
+}
+
+/** Delete of a small file with a few descriptors still opened on it. */
+static uint64_t
+run_delete_open(struct worker *w, int i)
+{
+	(void)i;
+	int fds[BENCH_DELETE_DESC_COUNT];
+	for (int j = 0; j < BENCH_DELETE_DESC_COUNT; ++j) {
+		fds[j] = ufs_open(w->name, UFS_CREATE);
+		check(fds[j] != -1, "open");
+	}
+	check(ufs_write(fds[0], w->buf, 1000) == 1000, "write");
+	uint64_t start = now_ns();
+	check(ufs_delete(w->name) == 0, "delete");
+	uint64_t end = now_ns();
+	for (int j = 0; j < BENCH_DELETE_DESC_COUNT; ++j)
+		check(ufs_close(fds[j]) == 0, "close");
+	return end - start;
+}
+
+/** Resize between random sizes up to the file size, both ways. */
+static uint64_t
+run_resize(struct worker *w, int i)
+{
+	(void)i;
+	size_t size = rng_next(w) % BENCH_FILE_SIZE;
+	uint64_t start = now_ns();
+	check(ufs_resize(w->fd, size) == 0, "resize");
+	return now_ns() - start;
+}
+
+struct bench_op {
+	const char *name;
+	/** Whether the operation is measured at each I/O size. */
+	bool has_size;
+	/** Not measured. */
+	void (*setup)(struct worker *w);
+	/** One operation. Returns its latency. */
+	uint64_t (*run)(struct worker *w, int i);
+	void (*teardown)(struct worker *w);
+};
+
+static const struct bench_op bench_ops[] = {
+	{"open_close", false, setup_none, run_open_close, teardown_open_close},
+	{"seq_write", true, setup_file, run_seq_write, teardown_file},
+	{"seq_read", true, setup_file, run_seq_read, teardown_file},
+	{"rand_write", true, setup_file, run_rand_write, teardown_file},
+	{"rand_read", true, setup_file, run_rand_read, teardown_file},
+	{"delete_open", false, setup_none, run_delete_open, teardown_none},
+	{"resize", false, setup_empty_file, run_resize, teardown_file},
+};
+
+static void *
+worker_f(void *arg)
+{
+	struct worker *w = arg;
+	w->op->setup(w);
+	pthread_barrier_wait(w->barrier);
+	w->start = now_ns();
+	for (int i = 0; i < w->op_count; ++i)
+		w->latencies[i] = w->op->run(w, i);
+	w->end = now_ns();
+	w->op->teardown(w);
+	return NULL;
+}
+
+static int
+cmp_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a;
+	uint64_t y = *(const uint64_t *)b;
+	return x < y ? -1 : x > y;
+}
+
+static void
+bench(const struct bench_op *op, size_t size, int thread_count, char *buf)
+{
+	int op_count = BENCH_MAX_OPS;
+	if (size > 0 && BENCH_BYTES / size < (size_t)op_count)
+		op_count = BENCH_BYTES / size;
+	if (op_count < BENCH_MIN_OPS)
+		op_count = BENCH_MIN_OPS;
+	pthread_barrier_t barrier;
+	pthread_barrier_init(&barrier, NULL, thread_count);
+	struct worker *workers = calloc(thread_count, sizeof(*workers));
+	uint64_t *latencies = malloc(sizeof(*latencies) * op_count *
+				     thread_count);
+	for (int i = 0; i < thread_count; ++i) {
+		struct worker *w = &workers[i];
+		w->op = op;
+		w->barrier = &barrier;
+		sprintf(w->name, "bench%d", i);
+		w->size = size;
+		w->buf = buf;
+		w->rng = 0x9e3779b97f4a7c15ull * (i + 1);
+		w->op_count = op_count;
+		w->latencies = latencies + (size_t)op_count * i;
+		pthread_create(&w->thread, NULL, worker_f, w);
+	}
+	uint64_t start = UINT64_MAX;
+	uint64_t end = 0;
+	for (int i = 0; i < thread_count; ++i) {
+		pthread_join(workers[i].thread, NULL);
+		if (workers[i].start < start)
+			start = workers[i].start;
+		if (workers[i].end > end)
+			end = workers[i].end;
+	}
+	size_t total = (size_t)op_count * thread_count;
+	qsort(latencies, total, sizeof(*latencies), cmp_u64);
+	printf("%s,%zu,%d,%zu,%.0f,%llu,%llu\n", op->name, size, thread_count,
+	       total, total / ((end - start) / 1e9),
+	       (unsigned long long)latencies[total / 2],
+	       (unsigned long long)latencies[total * 99 / 100]);
+	fflush(stdout);
+	free(latencies);
+	free(workers);
+	pthread_barrier_destroy(&barrier);
+}
+
+int
+main(int argc, char **argv)
+{
+	int max_threads = 4;
+	if (argc > 1)
+		max_threads = atoi(argv[1]);
+	if (max_threads <= 0) {
+		fprintf(stderr, "Usage: %s [max thread count]\n", argv[0]);
+		return 1;
+	}
+	static const size_t sizes[] = {1, 64, 4096, 65536, BENCH_MAX_IO_SIZE};
+	char *buf = malloc(BENCH_MAX_IO_SIZE);
+	memset(buf, 'x', BENCH_MAX_IO_SIZE);
+	printf("op,size,threads,ops,ops_per_sec,p50_ns,p99_ns\n");
+	for (size_t i = 0; i < sizeof(bench_ops) / sizeof(bench_ops[0]); ++i) {
+		const struct bench_op *op = &bench_ops[i];
+		for (int count = 1; count <= max_threads; count *= 2) {
+			if (!op->has_size) {
+				bench(op, 0, count, buf);
+				continue;
+			}
+			for (size_t j = 0; j < sizeof(sizes) / sizeof(sizes[0]);
+			     ++j)
+				bench(op, sizes[j], count, buf);
+		}
+	}
+	free(buf);
+	ufs_destroy();
+	return 0;
+}
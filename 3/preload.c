@@ -0,0 +1,877 @@
+#define _GNU_SOURCE
+#include "userfs.h"
+
+#include <dlfcn.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/**
+ * LD_PRELOAD shim which puts userfs under real programs. The file calls on
+ * the absolute paths starting with a prefix go to userfs, all the others go
+ * to the kernel as usual. The userfs file name is the path without the
+ * prefix.
+ *
+ * Each userfs descriptor is backed by an O_PATH kernel descriptor of
+ * /dev/null, so the program sees a real descriptor number which won't be
+ * given to anything else until closed. The calls are routed by that number.
+ * Any I/O which isn't routed fails on it with EBADF instead of being lost.
+ * dup() makes one more number for the same userfs descriptor, with the same
+ * position.
+ *
+ * userfs lives in the process memory, so by default the files die with the
+ * process. To pass them from one program to another, set UFS_PRELOAD_IMAGE:
+ * the image is loaded on start, if it exists, and saved on exit, if anything
+ * has changed.
+ *
+ *     UFS_PRELOAD_PREFIX - default "/ufs/".
+ *     UFS_PRELOAD_IMAGE - default none.
+ *
+ * $> LD_PRELOAD=./libufs_preload.so UFS_PRELOAD_IMAGE=ufs.img \
+ *        dd if=test.c of=/ufs/test.c
+ *
+ * Only open, openat, creat, read, write, pread, pwrite, lseek, ftruncate,
+ * close, dup, dup2, dup3, unlink and the access family are routed, plus their
+ * 64 variants. copy_file_range fails with EXDEV, so the programs fall back to
+ * read and write. fopen and fdopen of a userfs file make a stdio stream on
+ * top of the routed calls, with fopencookie(). Its fileno() is -1. A userfs
+ * file dup()ed over stdin or stdout gets such a stream too. Not routed:
+ *     - the calls glibc makes inside of itself, like freopen() and the rest
+ *       of stdio;
+ *     - fcntl, mmap, the stat family - they see /dev/null;
+ *     - the closes glibc makes inside of itself. The descriptor is dropped
+ *       when its number is given out again by an open;
+ *     - relative paths;
+ *     - the descriptors opened by a shell redirect - they die on exec().
+ * O_APPEND and O_EXCL are emulated with two userfs calls and aren't atomic.
+ */
+
+enum {
+	/** Descriptors per chunk of the table. */
+	PRELOAD_FD_CHUNK_SIZE = 1024,
+	PRELOAD_FD_CHUNK_COUNT = 1024,
+	/** Higher descriptors are never routed. */
+	PRELOAD_MAX_FD_COUNT = PRELOAD_FD_CHUNK_SIZE * PRELOAD_FD_CHUNK_COUNT,
+};
+
+/** Opened userfs file, shared by the kernel descriptors dup()ed from one. */
+struct preload_file {
+	int ufs_fd;
+	bool is_append;
+	/** Kernel descriptors pointing at the file. */
+	int refs;
+	struct preload_file *next_free;
+};
+
+/**
+ * Indexed by the kernel descriptor. NULL - not routed. A chunk is allocated
+ * with the first routed descriptor in it and is never moved or freed, so the
+ * slots can be read without the lock. A descriptor which isn't routed costs
+ * one or two loads then. The slots are changed and the files are referenced
+ * under the lock.
+ */
+static struct preload_file **fd_chunks[PRELOAD_FD_CHUNK_COUNT];
+static pthread_rwlock_t fds_lock = PTHREAD_RWLOCK_INITIALIZER;
+static const char *prefix = NULL;
+static size_t prefix_len = 0;
+static const char *image = NULL;
+static bool is_dirty = false;
+static pthread_mutex_t free_files_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct preload_file *free_files = NULL;
+
+static pthread_once_t resolve_once = PTHREAD_ONCE_INIT;
+static int (*default_open)(const char *, int, ...) = NULL;
+static int (*default_openat)(int, const char *, int, ...) = NULL;
+static ssize_t (*default_read)(int, void *, size_t) = NULL;
+static ssize_t (*default_write)(int, const void *, size_t) = NULL;
+static ssize_t (*default_pread)(int, void *, size_t, off_t) = NULL;
+static ssize_t (*default_pwrite)(int, const void *, size_t, off_t) = NULL;
+static off_t (*default_lseek)(int, off_t, int) = NULL;
+static int (*default_ftruncate)(int, off_t) = NULL;
+static int (*default_close)(int) = NULL;
+static int (*default_dup)(int) = NULL;
+static int (*default_dup2)(int, int) = NULL;
+static int (*default_dup3)(int, int, int) = NULL;
+static ssize_t (*default_copy_file_range)(int, off_t *, int, off_t *, size_t,
+					  unsigned) = NULL;
+static int (*default_unlink)(const char *) = NULL;
+static int (*default_access)(const char *, int) = NULL;
+static int (*default_faccessat)(int, const char *, int, int) = NULL;
+static int (*default_euidaccess)(const char *, int) = NULL;
+static FILE *(*default_fopen)(const char *, const char *) = NULL;
+static FILE *(*default_fdopen)(int, const char *) = NULL;
+
+static void
+preload_resolve_f(void)
+{
+	default_open = dlsym(RTLD_NEXT, "open");
+	default_openat = dlsym(RTLD_NEXT, "openat");
+	default_read = dlsym(RTLD_NEXT, "read");
+	default_write = dlsym(RTLD_NEXT, "write");
+	default_pread = dlsym(RTLD_NEXT, "pread");
+	default_pwrite = dlsym(RTLD_NEXT, "pwrite");
+	default_lseek = dlsym(RTLD_NEXT, "lseek");
+	default_ftruncate = dlsym(RTLD_NEXT, "ftruncate");
+	default_close = dlsym(RTLD_NEXT, "close");
+	default_dup = dlsym(RTLD_NEXT, "dup");
+	default_dup2 = dlsym(RTLD_NEXT, "dup2");
+	default_dup3 = dlsym(RTLD_NEXT, "dup3");
+	default_copy_file_range = dlsym(RTLD_NEXT, "copy_file_range");
+	default_unlink = dlsym(RTLD_NEXT, "unlink");
+	default_access = dlsym(RTLD_NEXT, "access");
+	default_faccessat = dlsym(RTLD_NEXT, "faccessat");
+	default_euidaccess = dlsym(RTLD_NEXT, "euidaccess");
+	default_fopen = dlsym(RTLD_NEXT, "fopen");
+	default_fdopen = dlsym(RTLD_NEXT, "fdopen");
+}
+
+/**
+ * Other libraries' constructors can do file calls before preload_init(), so
+ * each call makes sure the originals are known.
+ */
+static inline void
+preload_resolve(void)
+{
+	pthread_once(&resolve_once, preload_resolve_f);
+}
+
+static void
+preload_atexit(void)
+{
+	if (!__atomic_load_n(&is_dirty, __ATOMIC_RELAXED))
+		return;
+	if (ufs_snapshot(image) != 0) {
+		fprintf(stderr, "ufs_preload: can't save %s, error %d\n",
+			image, (int)ufs_errno());
+	}
+}
+
+__attribute__((constructor)) static void
+preload_init(void)
+{
+	preload_resolve();
+	const char *path = getenv("UFS_PRELOAD_PREFIX");
+	if (path == NULL || path[0] != '/')
+		path = "/ufs/";
+	prefix_len = strlen(path);
+	prefix = path;
+	image = getenv("UFS_PRELOAD_IMAGE");
+	if (image != NULL && access(image, F_OK) == 0 && ufs_load(image) != 0) {
+		fprintf(stderr, "ufs_preload: can't load %s, error %d\n",
+			image, (int)ufs_errno());
+	}
+	if (image != NULL)
+		atexit(preload_atexit);
+}
+
+/** userfs file name of the path, or NULL if the path isn't routed. */
+static const char *
+preload_name(const char *path)
+{
+	if (prefix == NULL || strncmp(path, prefix, prefix_len) != 0 ||
+	    path[prefix_len] == 0)
+		return NULL;
+	return path + prefix_len;
+}
+
+static struct preload_file *
+preload_file_new(int ufs_fd, bool is_append)
+{
+	pthread_mutex_lock(&free_files_lock);
+	struct preload_file *f = free_files;
+	if (f != NULL)
+		free_files = f->next_free;
+	pthread_mutex_unlock(&free_files_lock);
+	if (f == NULL && (f = malloc(sizeof(*f))) == NULL)
+		return NULL;
+	f->ufs_fd = ufs_fd;
+	f->is_append = is_append;
+	f->refs = 1;
+	return f;
+}
+
+static void
+preload_file_unref(struct preload_file *f)
+{
+	if (__atomic_sub_fetch(&f->refs, 1, __ATOMIC_ACQ_REL) > 0)
+		return;
+	ufs_close(f->ufs_fd);
+	pthread_mutex_lock(&free_files_lock);
+	f->next_free = free_files;
+	free_files = f;
+	pthread_mutex_unlock(&free_files_lock);
+}
+
+/**
+ * Slot of the kernel descriptor in the table, NULL if its chunk doesn't
+ * exist. With @a is_create the chunk is allocated, under the write lock.
+ */
+static struct preload_file **
+preload_fd_slot(int fd, bool is_create)
+{
+	if (fd < 0 || fd >= PRELOAD_MAX_FD_COUNT)
+		return NULL;
+	struct preload_file ***chunk = &fd_chunks[fd / PRELOAD_FD_CHUNK_SIZE];
+	struct preload_file **slots = __atomic_load_n(chunk, __ATOMIC_ACQUIRE);
+	if (slots == NULL && is_create) {
+		slots = calloc(PRELOAD_FD_CHUNK_SIZE, sizeof(*slots));
+		if (slots == NULL)
+			return NULL;
+		__atomic_store_n(chunk, slots, __ATOMIC_RELEASE);
+	}
+	return slots == NULL ? NULL : &slots[fd % PRELOAD_FD_CHUNK_SIZE];
+}
+
+/** Check without the lock if the descriptor may be routed. */
+static inline bool
+preload_fd_is_set(struct preload_file **slot)
+{
+	return slot != NULL && __atomic_load_n(slot, __ATOMIC_RELAXED) != NULL;
+}
+
+/**
+ * userfs file of the kernel descriptor, or NULL if it isn't routed. The file
+ * is referenced until preload_file_unref(), so a racing close() of the
+ * descriptor can't close the userfs descriptor under the call or give the
+ * file to another open.
+ */
+static struct preload_file *
+preload_acquire(int fd)
+{
+	struct preload_file **slot = preload_fd_slot(fd, false);
+	if (!preload_fd_is_set(slot))
+		return NULL;
+	pthread_rwlock_rdlock(&fds_lock);
+	struct preload_file *f = __atomic_load_n(slot, __ATOMIC_RELAXED);
+	if (f != NULL)
+		__atomic_add_fetch(&f->refs, 1, __ATOMIC_RELAXED);
+	pthread_rwlock_unlock(&fds_lock);
+	return f;
+}
+
+/**
+ * Point the kernel descriptor at the file, which gives its ref. Fails with
+ * EMFILE when the descriptor is above the table and with ENOMEM when its
+ * chunk can't be allocated.
+ */
+static int
+preload_fd_set(int fd, struct preload_file *f)
+{
+	pthread_rwlock_wrlock(&fds_lock);
+	struct preload_file **slot = preload_fd_slot(fd, f != NULL);
+	if (slot == NULL) {
+		pthread_rwlock_unlock(&fds_lock);
+		if (f == NULL)
+			return 0;
+		errno = fd >= PRELOAD_MAX_FD_COUNT ? EMFILE : ENOMEM;
+		return -1;
+	}
+	struct preload_file *old = __atomic_load_n(slot, __ATOMIC_RELAXED);
+	__atomic_store_n(slot, f, __ATOMIC_RELAXED);
+	pthread_rwlock_unlock(&fds_lock);
+	if (old != NULL)
+		preload_file_unref(old);
+	return 0;
+}
+
+/**
+ * Drop the userfs file of the kernel descriptor. Besides close() it is needed
+ * when the kernel gives out a number which is still in the table: glibc has
+ * closed it from inside, like fclose(stdout) does. The lock is taken only if
+ * there is something to drop.
+ */
+static void
+preload_forget(int fd)
+{
+	if (preload_fd_is_set(preload_fd_slot(fd, false)))
+		preload_fd_set(fd, NULL);
+}
+
+static void
+preload_set_dirty(void)
+{
+	__atomic_store_n(&is_dirty, true, __ATOMIC_RELAXED);
+}
+
+/**
+ * Set errno by the last userfs error and return -1. A missing file is
+ * ENOENT for a path and EBADF for a descriptor.
+ */
+static int
+preload_fail(bool is_fd)
+{
+	switch (ufs_errno()) {
+	case UFS_ERR_NO_FILE:
+		errno = is_fd ? EBADF : ENOENT;
+		break;
+	case UFS_ERR_NO_MEM:
+		errno = ENOSPC;
+		break;
+	case UFS_ERR_NO_PERMISSION:
+		errno = EBADF;
+		break;
+	case UFS_ERR_INVALID_ARG:
+		errno = EINVAL;
+		break;
+	default:
+		errno = EIO;
+		break;
+	}
+	return -1;
+}
+
+static int
+preload_open(const char *name, int flags)
+{
+	if ((flags & O_DIRECTORY) != 0) {
+		errno = ENOTDIR;
+		return -1;
+	}
+	int ufs_flags;
+	switch (flags & O_ACCMODE) {
+	case O_RDONLY:
+		ufs_flags = UFS_READ_ONLY;
+		break;
+	case O_WRONLY:
+		ufs_flags = UFS_WRITE_ONLY;
+		break;
+	default:
+		ufs_flags = UFS_READ_WRITE;
+		break;
+	}
+	if ((flags & O_CREAT) != 0) {
+		if ((flags & O_EXCL) != 0) {
+			int ufs_fd = ufs_open(name, 0);
+			if (ufs_fd != -1) {
+				ufs_close(ufs_fd);
+				errno = EEXIST;
+				return -1;
+			}
+		}
+		ufs_flags |= UFS_CREATE;
+	}
+	/* userfs dies on exec() anyway. */
+	int fd = default_open("/dev/null", O_PATH | O_CLOEXEC);
+	if (fd == -1)
+		return -1;
+	preload_forget(fd);
+	int ufs_fd = ufs_open(name, ufs_flags);
+	if (ufs_fd == -1) {
+		default_close(fd);
+		return preload_fail(false);
+	}
+	if ((flags & O_TRUNC) != 0 && (flags & O_ACCMODE) != O_RDONLY &&
+	    ufs_resize(ufs_fd, 0) != 0) {
+		ufs_close(ufs_fd);
+		default_close(fd);
+		return preload_fail(false);
+	}
+	struct preload_file *f = preload_file_new(ufs_fd,
+						  (flags & O_APPEND) != 0);
+	if (f == NULL) {
+		ufs_close(ufs_fd);
+		default_close(fd);
+		errno = ENOMEM;
+		return -1;
+	}
+	if ((flags & (O_CREAT | O_TRUNC)) != 0)
+		preload_set_dirty();
+	if (preload_fd_set(fd, f) != 0) {
+		int err = errno;
+		preload_file_unref(f);
+		default_close(fd);
+		errno = err;
+		return -1;
+	}
+	return fd;
+}
+
+static inline bool
+open_needs_mode(int flags)
+{
+	return (flags & O_CREAT) != 0 || (flags & O_TMPFILE) == O_TMPFILE;
+}
+
+int
+open(const char *path, int flags, ...)
+{
+	mode_t mode = 0;
+	if (open_needs_mode(flags)) {
+		va_list ap;
+		va_start(ap, flags);
+		mode = va_arg(ap, mode_t);
+		va_end(ap);
+	}
+	preload_resolve();
+	const char *name = preload_name(path);
+	if (name == NULL) {
+		int fd = default_open(path, flags, mode);
+		preload_forget(fd);
+		return fd;
+	}
+	return preload_open(name, flags);
+}
+
+int
+openat(int dirfd, const char *path, int flags, ...)
+{
+	mode_t mode = 0;
+	if (open_needs_mode(flags)) {
+		va_list ap;
+		va_start(ap, flags);
+		mode = va_arg(ap, mode_t);
+		va_end(ap);
+	}
+	preload_resolve();
+	/* Only absolute paths are routed, they don't depend on dirfd. */
+	const char *name = preload_name(path);
+	if (name == NULL) {
+		int fd = default_openat(dirfd, path, flags, mode);
+		preload_forget(fd);
+		return fd;
+	}
+	return preload_open(name, flags);
+}
+
+int
+creat(const char *path, mode_t mode)
+{
+	return open(path, O_CREAT | O_WRONLY | O_TRUNC, mode);
+}
+
+ssize_t
+read(int fd, void *buf, size_t size)
+{
+	preload_resolve();
+	struct preload_file *f = preload_acquire(fd);
+	if (f == NULL)
+		return default_read(fd, buf, size);
+	ssize_t rc = ufs_read(f->ufs_fd, buf, size);
+	if (rc < 0)
+		rc = preload_fail(true);
+	preload_file_unref(f);
+	return rc;
+}
+
+ssize_t
+write(int fd, const void *buf, size_t size)
+{
+	preload_resolve();
+	struct preload_file *f = preload_acquire(fd);
+	if (f == NULL)
+		return default_write(fd, buf, size);
+	ssize_t rc = -1;
+	if (f->is_append && ufs_seek(f->ufs_fd, 0, SEEK_END) < 0)
+		rc = preload_fail(true);
+	else if ((rc = ufs_write(f->ufs_fd, buf, size)) < 0)
+		rc = preload_fail(true);
+	else
+		preload_set_dirty();
+	preload_file_unref(f);
+	return rc;
+}
+
+ssize_t
+pread(int fd, void *buf, size_t size, off_t offset)
+{
+	preload_resolve();
+	struct preload_file *f = preload_acquire(fd);
+	if (f == NULL)
+		return default_pread(fd, buf, size, offset);
+	ssize_t rc;
+	if (offset < 0) {
+		errno = EINVAL;
+		rc = -1;
+	} else if ((rc = ufs_pread(f->ufs_fd, buf, size, offset)) < 0) {
+		rc = preload_fail(true);
+	}
+	preload_file_unref(f);
+	return rc;
+}
+
+ssize_t
+pwrite(int fd, const void *buf, size_t size, off_t offset)
+{
+	preload_resolve();
+	struct preload_file *f = preload_acquire(fd);
+	if (f == NULL)
+		return default_pwrite(fd, buf, size, offset);
+	ssize_t rc;
+	if (offset < 0) {
+		errno = EINVAL;
+		rc = -1;
+	} else if ((rc = ufs_pwrite(f->ufs_fd, buf, size, offset)) < 0) {
+		rc = preload_fail(true);
+	} else {
+		preload_set_dirty();
+	}
+	preload_file_unref(f);
+	return rc;
+}
+
+off_t
+lseek(int fd, off_t offset, int whence)
+{
+	preload_resolve();
+	struct preload_file *f = preload_acquire(fd);
+	if (f == NULL)
+		return default_lseek(fd, offset, whence);
+	off_t rc = ufs_seek(f->ufs_fd, offset, whence);
+	if (rc < 0)
+		rc = preload_fail(true);
+	preload_file_unref(f);
+	return rc;
+}
+
+int
+ftruncate(int fd, off_t length)
+{
+	preload_resolve();
+	struct preload_file *f = preload_acquire(fd);
+	if (f == NULL)
+		return default_ftruncate(fd, length);
+	int rc = 0;
+	if (length < 0) {
+		errno = EINVAL;
+		rc = -1;
+	} else if (ufs_resize(f->ufs_fd, length) != 0) {
+		rc = preload_fail(true);
+	} else {
+		preload_set_dirty();
+	}
+	preload_file_unref(f);
+	return rc;
+}
+
+int
+close(int fd)
+{
+	preload_resolve();
+	/* Forget the number before the kernel can give it to someone else. */
+	preload_forget(fd);
+	return default_close(fd);
+}
+
+/*
+ * fopen() and fdopen() of a userfs file make a stream on top of the routed
+ * calls. The cookie is the kernel descriptor.
+ */
+
+static ssize_t
+preload_cookie_read(void *cookie, char *buf, size_t size)
+{
+	return read((int)(intptr_t)cookie, buf, size);
+}
+
+/** fopencookie() wants 0, not -1, on an error. */
+static ssize_t
+preload_cookie_write(void *cookie, const char *buf, size_t size)
+{
+	ssize_t rc = write((int)(intptr_t)cookie, buf, size);
+	return rc < 0 ? 0 : rc;
+}
+
+static int
+preload_cookie_seek(void *cookie, off64_t *offset, int whence)
+{
+	off_t rc = lseek((int)(intptr_t)cookie, *offset, whence);
+	if (rc < 0)
+		return -1;
+	*offset = rc;
+	return 0;
+}
+
+static int
+preload_cookie_close(void *cookie)
+{
+	return close((int)(intptr_t)cookie);
+}
+
+/** Stream on top of a routed descriptor. The stream owns it. */
+static FILE *
+preload_fdopen(int fd, const char *mode)
+{
+	cookie_io_functions_t io = {
+		.read = preload_cookie_read,
+		.write = preload_cookie_write,
+		.seek = preload_cookie_seek,
+		.close = preload_cookie_close,
+	};
+	FILE *f = fopencookie((void *)(intptr_t)fd, mode, io);
+	/*
+	 * glibc marks a cookie stream with -2 here, and fileno() fails.
+	 * The programs fstat() the streams, so give them the descriptor.
+	 * The I/O still goes through the cookie functions.
+	 */
+	if (f != NULL)
+		f->_fileno = fd;
+	return f;
+}
+
+/**
+ * The standard streams do I/O with the calls glibc makes inside of itself,
+ * which aren't routed. When a userfs file is dup()ed over stdin or stdout,
+ * like 'sort -o' does, the stream is replaced with one on top of the routed
+ * calls. The old one is dropped as is, closing it would close the descriptor.
+ */
+static void
+preload_std_reopen(int fd)
+{
+	FILE **std;
+	const char *mode;
+	if (fd == STDIN_FILENO) {
+		std = &stdin;
+		mode = "r";
+	} else if (fd == STDOUT_FILENO) {
+		std = &stdout;
+		mode = "w";
+	} else {
+		return;
+	}
+	FILE *f = preload_fdopen(fd, mode);
+	if (f != NULL)
+		*std = f;
+}
+
+/**
+ * Point the new descriptor from dup() at the file of the old one. The ref
+ * taken by preload_acquire() goes to the new descriptor.
+ */
+static int
+preload_dup(struct preload_file *f, int new_fd)
+{
+	if (f == NULL) {
+		preload_forget(new_fd);
+		return new_fd;
+	}
+	if (new_fd < 0) {
+		preload_file_unref(f);
+		return new_fd;
+	}
+	if (preload_fd_set(new_fd, f) != 0) {
+		int err = errno;
+		preload_file_unref(f);
+		default_close(new_fd);
+		errno = err;
+		return -1;
+	}
+	preload_std_reopen(new_fd);
+	return new_fd;
+}
+
+int
+dup(int fd)
+{
+	preload_resolve();
+	struct preload_file *f = preload_acquire(fd);
+	return preload_dup(f, default_dup(fd));
+}
+
+int
+dup2(int fd, int new_fd)
+{
+	preload_resolve();
+	struct preload_file *f = preload_acquire(fd);
+	return preload_dup(f, default_dup2(fd, new_fd));
+}
+
+int
+dup3(int fd, int new_fd, int flags)
+{
+	preload_resolve();
+	struct preload_file *f = preload_acquire(fd);
+	return preload_dup(f, default_dup3(fd, new_fd, flags));
+}
+
+ssize_t
+copy_file_range(int in_fd, off_t *in_offset, int out_fd, off_t *out_offset,
+		size_t size, unsigned flags)
+{
+	preload_resolve();
+	struct preload_file *in = preload_acquire(in_fd);
+	struct preload_file *out = preload_acquire(out_fd);
+	if (in != NULL)
+		preload_file_unref(in);
+	if (out != NULL)
+		preload_file_unref(out);
+	if (in != NULL || out != NULL) {
+		errno = EXDEV;
+		return -1;
+	}
+	return default_copy_file_range(in_fd, in_offset, out_fd, out_offset,
+				       size, flags);
+}
+
+int
+unlink(const char *path)
+{
+	preload_resolve();
+	const char *name = preload_name(path);
+	if (name == NULL)
+		return default_unlink(path);
+	if (ufs_delete(name) != 0)
+		return preload_fail(false);
+	preload_set_dirty();
+	return 0;
+}
+
+/** Any file is readable and writable, nothing is executable. */
+static int
+preload_access(const char *name, int mode)
+{
+	int ufs_fd = ufs_open(name, 0);
+	if (ufs_fd == -1)
+		return preload_fail(false);
+	ufs_close(ufs_fd);
+	if ((mode & X_OK) != 0) {
+		errno = EACCES;
+		return -1;
+	}
+	return 0;
+}
+
+int
+access(const char *path, int mode)
+{
+	preload_resolve();
+	const char *name = preload_name(path);
+	if (name == NULL)
+		return default_access(path, mode);
+	return preload_access(name, mode);
+}
+
+int
+faccessat(int dirfd, const char *path, int mode, int flags)
+{
+	preload_resolve();
+	const char *name = preload_name(path);
+	if (name == NULL)
+		return default_faccessat(dirfd, path, mode, flags);
+	return preload_access(name, mode);
+}
+
+/** glibc's euidaccess() calls faccessat() from inside, not through here. */
+int
+euidaccess(const char *path, int mode)
+{
+	preload_resolve();
+	const char *name = preload_name(path);
+	if (name == NULL)
+		return default_euidaccess(path, mode);
+	return preload_access(name, mode);
+}
+
+int
+eaccess(const char *path, int mode)
+	__attribute__((alias("euidaccess")));
+
+/** open() flags of an fopen() mode, -1 if the mode is invalid. */
+static int
+preload_mode_flags(const char *mode)
+{
+	int flags;
+	switch (mode[0]) {
+	case 'r':
+		flags = 0;
+		break;
+	case 'w':
+		flags = O_CREAT | O_TRUNC;
+		break;
+	case 'a':
+		flags = O_CREAT | O_APPEND;
+		break;
+	default:
+		return -1;
+	}
+	bool is_update = false;
+	for (const char *c = mode + 1; *c != 0 && *c != ','; ++c) {
+		if (*c == '+')
+			is_update = true;
+		else if (*c == 'x')
+			flags |= O_EXCL;
+	}
+	if (is_update)
+		return flags | O_RDWR;
+	return flags | (mode[0] == 'r' ? O_RDONLY : O_WRONLY);
+}
+
+FILE *
+fopen(const char *path, const char *mode)
+{
+	preload_resolve();
+	const char *name = preload_name(path);
+	if (name == NULL)
+		return default_fopen(path, mode);
+	int flags = preload_mode_flags(mode);
+	if (flags == -1) {
+		errno = EINVAL;
+		return NULL;
+	}
+	int fd = preload_open(name, flags);
+	if (fd == -1)
+		return NULL;
+	FILE *f = preload_fdopen(fd, mode);
+	if (f == NULL) {
+		int err = errno;
+		close(fd);
+		errno = err;
+	}
+	return f;
+}
+
+FILE *
+fdopen(int fd, const char *mode)
+{
+	preload_resolve();
+	struct preload_file *f = preload_acquire(fd);
+	if (f == NULL)
+		return default_fdopen(fd, mode);
+	preload_file_unref(f);
+	return preload_fdopen(fd, mode);
+}
+
+/*
+ * off_t is 64 bit here, so the 64 variants are the same functions. They are
+ * separate symbols though, used by the programs built with
+ * _FILE_OFFSET_BITS=64.
+ */
+_Static_assert(sizeof(off_t) == 8, "off_t is 64 bit");
+
+int
+open64(const char *path, int flags, ...)
+	__attribute__((alias("open")));
+
+int
+openat64(int dirfd, const char *path, int flags, ...)
+	__attribute__((alias("openat")));
+
+int
+creat64(const char *path, mode_t mode)
+	__attribute__((alias("creat")));
+
+FILE *
+fopen64(const char *path, const char *mode)
+	__attribute__((alias("fopen")));
+
+ssize_t
+pread64(int fd, void *buf, size_t size, off_t offset)
+	__attribute__((alias("pread")));
+
+ssize_t
+pwrite64(int fd, const void *buf, size_t size, off_t offset)
+	__attribute__((alias("pwrite")));
+
+off_t
+lseek64(int fd, off_t offset, int whence)
+	__attribute__((alias("lseek")));
+
+int
+ftruncate64(int fd, off_t length)
+	__attribute__((alias("ftruncate")));
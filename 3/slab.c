@@ -0,0 +1,272 @@
+#include "slab.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+
+enum {
+	/** How many free objects of each cache a thread keeps at most. */
+	SLAB_STASH_SIZE = 64,
+	/** How many objects a stash gets or returns at once. */
+	SLAB_STASH_BATCH = SLAB_STASH_SIZE / 2,
+	SLAB_MAX_CACHES = 32,
+};
+
+/**
+ * Slab header, at the start of the slab. The objects follow it. The ones
+ * never given out are not touched, so a fresh slab costs no page faults
+ * beyond the used objects.
+ */
+struct slab {
+	struct slab_cache *cache;
+	/** Freed objects, linked through their first bytes. */
+	void *free_list;
+	/** Objects never given out start from here. */
+	char *unused;
+	char *end;
+	int used_count;
+	/** Neighbours in the partial list. */
+	struct slab *prev;
+	struct slab *next;
+};
+
+enum {
+	SLAB_HEADER_SIZE = (sizeof(struct slab) + 63) & ~63,
+};
+
+struct slab_stash {
+	void *objects[SLAB_STASH_SIZE];
+	int count;
+	unsigned generation;
+};
+
+static __thread struct slab_stash slab_stashes[SLAB_MAX_CACHES];
+/** Whether the current thread has its stashes flushed on exit. */
+static __thread bool slab_thread_is_known = false;
+
+static pthread_mutex_t slab_caches_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct slab_cache *slab_caches[SLAB_MAX_CACHES];
+static int slab_cache_count = 0;
+static pthread_once_t slab_thread_key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t slab_thread_key;
+
+static struct slab *
+slab_of(void *ptr)
+{
+	return (struct slab *)((uintptr_t)ptr & ~(uintptr_t)(SLAB_SIZE - 1));
+}
+
+static bool
+slab_is_full(const struct slab *slab)
+{
+	return slab->free_list == NULL && slab->unused == slab->end;
+}
+
+static void
+slab_reset(struct slab *slab)
+{
+	slab->free_list = NULL;
+	slab->unused = (char *)slab + SLAB_HEADER_SIZE;
+	slab->used_count = 0;
+}
+
+static void
+slab_list_add(struct slab **list, struct slab *slab)
+{
+	slab->prev = NULL;
+	slab->next = *list;
+	if (*list != NULL)
+		(*list)->prev = slab;
+	*list = slab;
+}
+
+static void
+slab_list_remove(struct slab **list, struct slab *slab)
+{
+	if (slab->prev != NULL)
+		slab->prev->next = slab->next;
+	else
+		*list = slab->next;
+	if (slab->next != NULL)
+		slab->next->prev = slab->prev;
+}
+
+/** Map a new slab aligned by its size, so slab_of() works. */
+static struct slab *
+slab_new(struct slab_cache *cache)
+{
+	char *addr = mmap(NULL, SLAB_SIZE * 2, PROT_READ | PROT_WRITE,
+			  MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (addr == MAP_FAILED)
+		abort();
+	char *start = (char *)(((uintptr_t)addr + SLAB_SIZE - 1) &
+			       ~(uintptr_t)(SLAB_SIZE - 1));
+	if (start > addr)
+		munmap(addr, start - addr);
+	munmap(start + SLAB_SIZE, addr + SLAB_SIZE - start);
+	struct slab *slab = (struct slab *)start;
+	slab->cache = cache;
+	slab->end = (char *)slab + SLAB_HEADER_SIZE +
+		    cache->object_size * cache->object_count;
+	slab_reset(slab);
+	return slab;
+}
+
+/**
+ * Take objects for the stash from the slabs. The partially used slabs go
+ * first, so the others have a chance to become empty.
+ */
+static void
+slab_stash_refill(struct slab_cache *cache, struct slab_stash *stash)
+{
+	pthread_mutex_lock(&cache->lock);
+	while (stash->count < SLAB_STASH_BATCH) {
+		struct slab *slab = cache->partial;
+		if (slab == NULL) {
+			slab = cache->empty;
+			cache->empty = NULL;
+			if (slab == NULL)
+				slab = slab_new(cache);
+			slab_list_add(&cache->partial, slab);
+		}
+		void *ptr;
+		if (slab->free_list != NULL) {
+			ptr = slab->free_list;
+			slab->free_list = *(void **)ptr;
+		} else {
+			ptr = slab->unused;
+			slab->unused += cache->object_size;
+		}
+		++slab->used_count;
+		if (slab_is_full(slab))
+			slab_list_remove(&cache->partial, slab);
+		stash->objects[stash->count++] = ptr;
+	}
+	pthread_mutex_unlock(&cache->lock);
+}
+
+/** Return the last @a count objects of the stash into their slabs. */
+static void
+slab_stash_flush(struct slab_cache *cache, struct slab_stash *stash, int count)
+{
+	pthread_mutex_lock(&cache->lock);
+	for (; count > 0; --count) {
+		void *ptr = stash->objects[--stash->count];
+		struct slab *slab = slab_of(ptr);
+		if (slab_is_full(slab))
+			slab_list_add(&cache->partial, slab);
+		*(void **)ptr = slab->free_list;
+		slab->free_list = ptr;
+		if (--slab->used_count > 0)
+			continue;
+		slab_list_remove(&cache->partial, slab);
+		if (cache->empty == NULL) {
+			slab_reset(slab);
+			cache->empty = slab;
+		} else {
+			munmap(slab, SLAB_SIZE);
+		}
+	}
+	pthread_mutex_unlock(&cache->lock);
+}
+
+/** Return the stashes of a finished thread into their caches. */
+static void
+slab_thread_exit_f(void *arg)
+{
+	(void)arg;
+	pthread_mutex_lock(&slab_caches_lock);
+	int cache_count = slab_cache_count;
+	pthread_mutex_unlock(&slab_caches_lock);
+	for (int i = 0; i < cache_count; ++i) {
+		struct slab_stash *stash = &slab_stashes[i];
+		struct slab_cache *cache = slab_caches[i];
+		if (stash->count > 0 && stash->generation == cache->generation)
+			slab_stash_flush(cache, stash, stash->count);
+	}
+}
+
+static void
+slab_thread_key_create(void)
+{
+	pthread_key_create(&slab_thread_key, slab_thread_exit_f);
+}
+
+static int
+slab_cache_register(struct slab_cache *cache)
+{
+	pthread_mutex_lock(&slab_caches_lock);
+	if (cache->id == 0) {
+		if (slab_cache_count == SLAB_MAX_CACHES)
+			abort();
+		cache->object_count = (SLAB_SIZE - SLAB_HEADER_SIZE) /
+				      cache->object_size;
+		if (cache->object_count < SLAB_MIN_OBJECT_COUNT)
+			abort();
+		slab_caches[slab_cache_count++] = cache;
+		__atomic_store_n(&cache->id, slab_cache_count,
+				 __ATOMIC_RELEASE);
+	}
+	pthread_mutex_unlock(&slab_caches_lock);
+	return cache->id;
+}
+
+static struct slab_stash *
+slab_stash_of(struct slab_cache *cache)
+{
+	int id = __atomic_load_n(&cache->id, __ATOMIC_ACQUIRE);
+	if (id == 0)
+		id = slab_cache_register(cache);
+	if (!slab_thread_is_known) {
+		/* Any non-NULL value makes the destructor run. */
+		pthread_once(&slab_thread_key_once, slab_thread_key_create);
+		pthread_setspecific(slab_thread_key, &slab_thread_is_known);
+		slab_thread_is_known = true;
+	}
+	struct slab_stash *stash = &slab_stashes[id - 1];
+	if (stash->generation != cache->generation) {
+		stash->count = 0;
+		stash->generation = cache->generation;
+	}
+	return stash;
+}
+
+void *
+slab_alloc(struct slab_cache *cache)
+{
+	struct slab_stash *stash = slab_stash_of(cache);
+	if (stash->count == 0)
+		slab_stash_refill(cache, stash);
+	return stash->objects[--stash->count];
+}
+
+void
+slab_free(struct slab_cache *cache, void *ptr)
+{
+	struct slab_stash *stash = slab_stash_of(cache);
+	if (stash->count == SLAB_STASH_SIZE)
+		slab_stash_flush(cache, stash, SLAB_STASH_BATCH);
+	stash->objects[stash->count++] = ptr;
+}
+
+void
+slab_cache_destroy(struct slab_cache *cache)
+{
+	if (cache->id == 0)
+		return;
+	struct slab_stash *stash = slab_stash_of(cache);
+	slab_stash_flush(cache, stash, stash->count);
+	pthread_mutex_lock(&cache->lock);
+	struct slab *next;
+	for (struct slab *slab = cache->partial; slab != NULL; slab = next) {
+		next = slab->next;
+		munmap(slab, SLAB_SIZE);
+	}
+	cache->partial = NULL;
+	if (cache->empty != NULL)
+		munmap(cache->empty, SLAB_SIZE);
+	cache->empty = NULL;
+	++cache->generation;
+	pthread_mutex_unlock(&cache->lock);
+}
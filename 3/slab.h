@@ -0,0 +1,62 @@
+#pragma once
+
+#include <pthread.h>
+#include <stddef.h>
+
+enum {
+	/** Size and alignment of a slab. */
+	SLAB_SIZE = 256 * 1024,
+	/** Less objects per slab would waste too much memory. */
+	SLAB_MIN_OBJECT_COUNT = 4,
+};
+
+/**
+ * Allocator of objects of one size. The objects are cut from big aligned
+ * slabs taken right from the OS. Each thread keeps a small stash of free
+ * objects of each cache, so most of the allocations and frees don't touch any
+ * shared state. The slab of an object is found by its address, so the object
+ * doesn't need any header. An empty slab is returned to the OS, except one
+ * per cache kept against the churn on the border of a slab.
+ */
+struct slab_cache {
+	/** Object size, a multiple of 16. */
+	size_t object_size;
+	/** How many objects fit into one slab. */
+	int object_count;
+	/** Index of the stashes of the cache in each thread. 0 - not set. */
+	int id;
+	/**
+	 * Bumped by each destroy, so the stashes left from before are
+	 * forgotten instead of being returned into the freed slabs.
+	 */
+	unsigned generation;
+	/** Protects the slab lists. */
+	pthread_mutex_t lock;
+	/** Slabs with both used and free objects. */
+	struct slab *partial;
+	/** Spare empty slab. */
+	struct slab *empty;
+};
+
+/**
+ * Initializer for a static cache. Objects of @a size bytes must fit into a
+ * slab at least SLAB_MIN_OBJECT_COUNT times.
+ */
+#define SLAB_CACHE_INITIALIZER(size) {					\
+	.object_size = ((size) + 15) & ~(size_t)15,			\
+	.lock = PTHREAD_MUTEX_INITIALIZER,				\
+}
+
+void *
+slab_alloc(struct slab_cache *cache);
+
+void
+slab_free(struct slab_cache *cache, void *ptr);
+
+/**
+ * Free all the slabs of the cache. All the objects must be freed before, and
+ * the other threads which used the cache must be finished. The cache can be
+ * used again after that.
+ */
+void
+slab_cache_destroy(struct slab_cache *cache);
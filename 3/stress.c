@@ -0,0 +1,251 @@
+#include "userfs.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/**
+ * Multi-threaded test and benchmark of userfs.
+ *
+ * First each thread reads its own file, for 1, 2, 4, ... threads. The total
+ * speed should grow linearly with the thread count up to the core count.
+ *
+ * Then the threads hammer a small set of shared files with random opens,
+ * writes, reads, resizes, closes, deletes and clones. Meanwhile each thread
+ * also writes and checks its own private file. Any lost or mixed up data of
+ * the private files or a crash is a failure.
+ *
+ * $> ./stress [max thread count]
+ */
+
+enum {
+	STRESS_FILE_SIZE = 1024 * 1024,
+	STRESS_READ_SIZE = 4096,
+	STRESS_READ_TOTAL = 1024 * 1024 * 1024,
+	STRESS_SHARED_FILE_COUNT = 8,
+	STRESS_OP_COUNT = 200000,
+};
+
+static double
+now_sec(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void
+check(bool ok, const char *what)
+{
+	if (ok)
+		return;
+	printf("%s failed, error %d\n", what, (int)ufs_errno());
+	exit(1);
+}
+
+static uint32_t
+rng_next(uint64_t *state)
+{
+	*state ^= *state << 13;
+	*state ^= *state >> 7;
+	*state ^= *state << 17;
+	return *state >> 32;
+}
+
+struct worker {
+	pthread_t thread;
+	int id;
+	int thread_count;
+};
+
+static void *
+worker_read_f(void *arg)
+{
+	struct worker *w = arg;
+	char name[32];
+	sprintf(name, "read%d", w->id);
+	char *buf = malloc(STRESS_READ_SIZE);
+	int fd = ufs_open(name, 0);
+	check(fd != -1, "open");
+	size_t need = (size_t)STRESS_READ_TOTAL / w->thread_count;
+	for (size_t total = 0; total < need;) {
+		ssize_t rc = ufs_read(fd, buf, STRESS_READ_SIZE);
+		check(rc >= 0, "read");
+		if (rc == 0) {
+			check(ufs_close(fd) == 0, "close");
+			fd = ufs_open(name, 0);
+			check(fd != -1, "open");
+		}
+		total += rc;
+	}
+	check(ufs_close(fd) == 0, "close");
+	free(buf);
+	return NULL;
+}
+
+static void
+bench_read(int thread_count)
+{
+	char *buf = malloc(STRESS_FILE_SIZE);
+	memset(buf, 'x', STRESS_FILE_SIZE);
+	struct worker *workers = calloc(thread_count, sizeof(*workers));
+	for (int i = 0; i < thread_count; ++i) {
+		char name[32];
+		sprintf(name, "read%d", i);
+		int fd = ufs_open(name, UFS_CREATE);
+		check(ufs_write(fd, buf, STRESS_FILE_SIZE) == STRESS_FILE_SIZE,
+		      "write");
+		check(ufs_close(fd) == 0, "close");
+		workers[i].id = i;
+		workers[i].thread_count = thread_count;
+	}
+	double start = now_sec();
+	for (int i = 0; i < thread_count; ++i)
+		pthread_create(&workers[i].thread, NULL, worker_read_f,
+			       &workers[i]);
+	for (int i = 0; i < thread_count; ++i)
+		pthread_join(workers[i].thread, NULL);
+	double duration = now_sec() - start;
+	for (int i = 0; i < thread_count; ++i) {
+		char name[32];
+		sprintf(name, "read%d", i);
+		check(ufs_delete(name) == 0, "delete");
+	}
+	printf("read, %2d threads: %8.1f MB/sec\n", thread_count,
+	       STRESS_READ_TOTAL / duration / (1024 * 1024));
+	free(workers);
+	free(buf);
+}
+
+/** One random operation with a shared file. Errors are expected here. */
+static void
+stress_shared_op(uint64_t *rng, int *fds)
+{
+	char name[32];
+	int i = rng_next(rng) % STRESS_SHARED_FILE_COUNT;
+	sprintf(name, "shared%d", i);
+	char buf[1024];
+	switch (rng_next(rng) % 7) {
+	case 0:
+		if (fds[i] == -1)
+			fds[i] = ufs_open(name, UFS_CREATE);
+		break;
+	case 1:
+		if (fds[i] != -1) {
+			memset(buf, 'a' + i, sizeof(buf));
+			ufs_write(fds[i], buf, rng_next(rng) % sizeof(buf));
+		}
+		break;
+	case 2:
+		if (fds[i] != -1)
+			ufs_read(fds[i], buf, rng_next(rng) % sizeof(buf));
+		break;
+	case 3:
+		if (fds[i] != -1)
+			ufs_resize(fds[i], rng_next(rng) % (64 * 1024));
+		break;
+	case 4:
+		if (fds[i] != -1) {
+			check(ufs_close(fds[i]) == 0, "close");
+			fds[i] = -1;
+		}
+		break;
+	case 5:
+		ufs_delete(name);
+		break;
+	case 6: {
+		char dst[32];
+		sprintf(dst, "shared%d",
+			(int)(rng_next(rng) % STRESS_SHARED_FILE_COUNT));
+		ufs_clone(name, dst);
+		break;
+	}
+	}
+}
+
+static void *
+worker_stress_f(void *arg)
+{
+	struct worker *w = arg;
+	uint64_t rng = 0x9e3779b97f4a7c15ull * (w->id + 1);
+	int fds[STRESS_SHARED_FILE_COUNT];
+	for (int i = 0; i < STRESS_SHARED_FILE_COUNT; ++i)
+		fds[i] = -1;
+	char name[32];
+	sprintf(name, "private%d", w->id);
+	int out = ufs_open(name, UFS_CREATE);
+	int in = ufs_open(name, 0);
+	check(out != -1 && in != -1, "open private");
+	uint32_t next_out = 0;
+	uint32_t next_in = 0;
+	for (int op = 0; op < STRESS_OP_COUNT; ++op) {
+		stress_shared_op(&rng, fds);
+		/* The private file gets a growing sequence of numbers. */
+		if (op % 4 == 0) {
+			check(ufs_write(out, (char *)&next_out,
+					sizeof(next_out)) == sizeof(next_out),
+			      "write private");
+			++next_out;
+		} else if (next_in < next_out) {
+			uint32_t value;
+			check(ufs_read(in, (char *)&value, sizeof(value)) ==
+			      sizeof(value), "read private");
+			check(value == next_in, "private data");
+			++next_in;
+		}
+	}
+	for (int i = 0; i < STRESS_SHARED_FILE_COUNT; ++i) {
+		if (fds[i] != -1)
+			check(ufs_close(fds[i]) == 0, "close");
+	}
+	check(ufs_close(out) == 0 && ufs_close(in) == 0, "close private");
+	check(ufs_delete(name) == 0, "delete private");
+	return NULL;
+}
+
+static void
+stress(int thread_count)
+{
+	struct worker *workers = calloc(thread_count, sizeof(*workers));
+	double start = now_sec();
+	for (int i = 0; i < thread_count; ++i) {
+		workers[i].id = i;
+		workers[i].thread_count = thread_count;
+		pthread_create(&workers[i].thread, NULL, worker_stress_f,
+			       &workers[i]);
+	}
+	for (int i = 0; i < thread_count; ++i)
+		pthread_join(workers[i].thread, NULL);
+	double duration = now_sec() - start;
+	for (int i = 0; i < STRESS_SHARED_FILE_COUNT; ++i) {
+		char name[32];
+		sprintf(name, "shared%d", i);
+		ufs_delete(name);
+	}
+	printf("stress, %2d threads: %10.0f ops/sec\n", thread_count,
+	       (double)STRESS_OP_COUNT * thread_count / duration);
+	free(workers);
+}
+
+int
+main(int argc, char **argv)
+{
+	int max_threads = 8;
+	if (argc > 1)
+		max_threads = atoi(argv[1]);
+	if (max_threads <= 0) {
+		fprintf(stderr, "Usage: %s [max thread count]\n", argv[0]);
+		return 1;
+	}
+	for (int count = 1; count <= max_threads; count *= 2)
+		bench_read(count);
+	for (int count = 1; count <= max_threads; count *= 2)
+		stress(count);
+	ufs_destroy();
+	printf("All is ok\n");
+	return 0;
+}
@@ -3,6 +3,7 @@
 #include <assert.h>
 #include <limits.h>
 #include <string.h>
+#include <unistd.h>
 
 static void
 test_open(void)
@@ -441,6 +442,421 @@ test_resize(void)
 #endif
 }
 
+static void
+test_positional_io(void)
+{
+	unit_test_start();
+
+	int fd = ufs_open("file", UFS_CREATE);
+	unit_fail_if(fd == -1);
+	ssize_t rc = ufs_write(fd, "123456", 6);
+	unit_fail_if(rc != 6);
+	rc = ufs_pwrite(fd, "ab", 2, 2);
+	unit_check(rc == 2, "pwrite inside the file");
+	rc = ufs_write(fd, "78", 2);
+	unit_check(rc == 2, "pwrite didn't move the position");
+	char buffer[2048];
+	rc = ufs_pread(fd, buffer, sizeof(buffer), 1);
+	unit_check(rc == 7 && memcmp(buffer, "2ab5678", 7) == 0,
+		   "pread from the middle");
+	rc = ufs_pread(fd, buffer, sizeof(buffer), 100);
+	unit_check(rc == 0, "pread behind the end is EOF");
+	rc = ufs_pwrite(fd, "", 0, 1000);
+	unit_check(rc == 0, "empty pwrite behind the end");
+	rc = ufs_pread(fd, buffer, sizeof(buffer), 0);
+	unit_check(rc == 8, "empty pwrite doesn't grow the file");
+	rc = ufs_pwrite(fd, "end", 3, 2000);
+	unit_fail_if(rc != 3);
+	rc = ufs_pread(fd, buffer, sizeof(buffer), 0);
+	unit_check(rc == 2003, "pwrite behind the end grows the file");
+	bool is_zero = true;
+	for (int i = 8; i < 2000; ++i)
+		is_zero = is_zero && buffer[i] == 0;
+	unit_check(is_zero && memcmp(buffer + 2000, "end", 3) == 0,
+		   "the gap is filled with zeros");
+	rc = ufs_pwrite(fd, "x", 1, 1024 * 1024 * 100);
+	unit_check(rc == -1 && ufs_errno() == UFS_ERR_NO_MEM,
+		   "pwrite behind the max size");
+	unit_fail_if(ufs_close(fd) != 0);
+	unit_fail_if(ufs_delete("file") != 0);
+
+	unit_test_finish();
+}
+
+static void
+test_vectored_io(void)
+{
+	unit_test_start();
+
+	int fd = ufs_open("file", UFS_CREATE);
+	unit_fail_if(fd == -1);
+	/* Records crossing the borders of the first blocks. */
+	char records[100][37];
+	struct iovec iov[100];
+	for (int i = 0; i < 100; ++i) {
+		memset(records[i], 'a' + i % 26, sizeof(records[i]));
+		iov[i].iov_base = records[i];
+		iov[i].iov_len = sizeof(records[i]);
+	}
+	ssize_t rc = ufs_writev(fd, iov, 100);
+	unit_check(rc == sizeof(records), "writev");
+	rc = ufs_writev(fd, iov, 0);
+	unit_check(rc == 0, "empty writev");
+
+	int fd2 = ufs_open("file", 0);
+	unit_fail_if(fd2 == -1);
+	char head[5];
+	char copy[100][37];
+	struct iovec in[101];
+	in[0].iov_base = head;
+	in[0].iov_len = sizeof(head);
+	for (int i = 0; i < 100; ++i) {
+		in[i + 1].iov_base = copy[i];
+		in[i + 1].iov_len = sizeof(copy[i]);
+	}
+	rc = ufs_readv(fd2, in, 101);
+	unit_check(rc == sizeof(records), "readv stops at the end");
+	unit_check(memcmp(head, records[0], sizeof(head)) == 0 &&
+		   memcmp(copy, (char *)records + sizeof(head),
+			  sizeof(records) - sizeof(head)) == 0,
+		   "readv data is correct");
+	rc = ufs_readv(fd2, in, 101);
+	unit_check(rc == 0, "readv at the end is EOF");
+	unit_fail_if(ufs_close(fd2) != 0);
+	unit_fail_if(ufs_close(fd) != 0);
+	unit_fail_if(ufs_delete("file") != 0);
+
+	unit_test_finish();
+}
+
+static void
+test_read_view(void)
+{
+	unit_test_start();
+
+	int fd = ufs_open("file", UFS_CREATE);
+	unit_fail_if(fd == -1);
+	char buffer[5000];
+	for (int i = 0; i < (int)sizeof(buffer); ++i)
+		buffer[i] = 'a' + i % 26;
+	ssize_t rc = ufs_write(fd, buffer, sizeof(buffer));
+	unit_fail_if(rc != sizeof(buffer));
+
+	int fd2 = ufs_open("file", 0);
+	unit_fail_if(fd2 == -1);
+	struct iovec *iov;
+	int iovcnt;
+	rc = ufs_read_view(fd2, 100, &iov, &iovcnt);
+	unit_check(rc == 100 && iovcnt == 1 && iov[0].iov_len == 100 &&
+		   memcmp(iov[0].iov_base, buffer, 100) == 0, "small view");
+	ufs_release_view(iov, iovcnt);
+
+	rc = ufs_read_view(fd2, sizeof(buffer), &iov, &iovcnt);
+	unit_check(rc == sizeof(buffer) - 100, "view stops at the end");
+	unit_check(iovcnt > 1, "view spans several blocks");
+	size_t pos = 100;
+	bool is_equal = true;
+	for (int i = 0; i < iovcnt; ++i) {
+		is_equal = is_equal && memcmp(iov[i].iov_base, buffer + pos,
+					      iov[i].iov_len) == 0;
+		pos += iov[i].iov_len;
+	}
+	unit_check(is_equal && pos == sizeof(buffer), "view data is correct");
+	struct iovec *empty;
+	int empty_count;
+	rc = ufs_read_view(fd2, 10, &empty, &empty_count);
+	unit_check(rc == 0 && empty == NULL && empty_count == 0,
+		   "view at the end is EOF");
+
+	rc = ufs_pwrite(fd, "xxxxx", 5, 4000);
+	unit_fail_if(rc != 5);
+	unit_fail_if(ufs_resize(fd, 10) != 0);
+	unit_fail_if(ufs_resize(fd, 4500) != 0);
+	unit_fail_if(ufs_close(fd) != 0);
+	unit_fail_if(ufs_close(fd2) != 0);
+	unit_fail_if(ufs_delete("file") != 0);
+	pos = 100;
+	is_equal = true;
+	for (int i = 0; i < iovcnt; ++i) {
+		is_equal = is_equal && memcmp(iov[i].iov_base, buffer + pos,
+					      iov[i].iov_len) == 0;
+		pos += iov[i].iov_len;
+	}
+	unit_check(is_equal, "view survives write, resize and delete");
+	ufs_release_view(iov, iovcnt);
+
+	unit_test_finish();
+}
+
+static void
+test_snapshot(void)
+{
+	unit_test_start();
+
+	const char *path = "test_image.ufs";
+	char data[5000];
+	for (int i = 0; i < (int)sizeof(data); ++i)
+		data[i] = 'a' + i % 26;
+	int fd = ufs_open("big", UFS_CREATE);
+	unit_fail_if(fd == -1);
+	unit_fail_if(ufs_write(fd, data, sizeof(data)) != sizeof(data));
+	unit_fail_if(ufs_close(fd) != 0);
+	fd = ufs_open("small", UFS_CREATE);
+	unit_fail_if(fd == -1);
+	unit_fail_if(ufs_write(fd, "hello", 5) != 5);
+	unit_fail_if(ufs_close(fd) != 0);
+	fd = ufs_open("empty", UFS_CREATE);
+	unit_fail_if(fd == -1);
+	unit_fail_if(ufs_close(fd) != 0);
+	unit_check(ufs_snapshot(path) == 0, "snapshot");
+	unit_fail_if(ufs_delete("big") != 0);
+	unit_fail_if(ufs_delete("small") != 0);
+	unit_fail_if(ufs_delete("empty") != 0);
+
+	unit_check(ufs_load(path) == 0, "load");
+	char buffer[6000];
+	fd = ufs_open("big", 0);
+	unit_fail_if(fd == -1);
+	unit_check(ufs_read(fd, buffer, sizeof(buffer)) == sizeof(data) &&
+		   memcmp(buffer, data, sizeof(data)) == 0, "big file is loaded");
+	unit_fail_if(ufs_pwrite(fd, "zzz", 3, 100) != 3);
+	unit_fail_if(ufs_pwrite(fd, "end", 3, sizeof(data)) != 3);
+	unit_fail_if(ufs_pread(fd, buffer, sizeof(buffer), 0) !=
+		     sizeof(data) + 3);
+	unit_check(memcmp(buffer + 100, "zzz", 3) == 0 &&
+		   memcmp(buffer + sizeof(data), "end", 3) == 0,
+		   "loaded file is writable");
+	unit_fail_if(ufs_close(fd) != 0);
+	fd = ufs_open("small", 0);
+	unit_fail_if(fd == -1);
+	unit_check(ufs_read(fd, buffer, sizeof(buffer)) == 5 &&
+		   memcmp(buffer, "hello", 5) == 0, "small file is loaded");
+	unit_fail_if(ufs_resize(fd, 1) != 0);
+	unit_fail_if(ufs_resize(fd, 10) != 0);
+	unit_check(ufs_pread(fd, buffer, sizeof(buffer), 0) == 10 &&
+		   memcmp(buffer, "h\0\0\0\0\0\0\0\0\0", 10) == 0,
+		   "loaded file is resizable");
+	unit_fail_if(ufs_close(fd) != 0);
+	fd = ufs_open("empty", 0);
+	unit_check(fd != -1 && ufs_read(fd, buffer, sizeof(buffer)) == 0,
+		   "empty file is loaded");
+	unit_fail_if(ufs_close(fd) != 0);
+
+	unit_check(ufs_load(path) == 0, "load again");
+	fd = ufs_open("big", 0);
+	unit_fail_if(fd == -1);
+	unit_check(ufs_read(fd, buffer, sizeof(buffer)) == sizeof(data) &&
+		   memcmp(buffer, data, sizeof(data)) == 0,
+		   "writes didn't change the image");
+	unit_fail_if(ufs_close(fd) != 0);
+	unit_fail_if(ufs_delete("big") != 0);
+	unit_fail_if(ufs_delete("small") != 0);
+	unit_fail_if(ufs_delete("empty") != 0);
+
+	FILE *file = fopen(path, "r+");
+	unit_fail_if(file == NULL);
+	unit_fail_if(fwrite("garbage", 1, 7, file) != 7);
+	unit_fail_if(fclose(file) != 0);
+	unit_check(ufs_load(path) == -1 && ufs_errno() == UFS_ERR_IO,
+		   "damaged image is not loaded");
+	unit_fail_if(unlink(path) != 0);
+	unit_check(ufs_load(path) == -1 && ufs_errno() == UFS_ERR_IO,
+		   "no image");
+
+	unit_test_finish();
+}
+
+static void
+test_sparse(void)
+{
+#ifdef NEED_RESIZE
+	unit_test_start();
+
+	int fd = ufs_open("file", UFS_CREATE);
+	unit_fail_if(fd == -1);
+	unit_fail_if(ufs_write(fd, "abcdef", 6) != 6);
+	unit_fail_if(ufs_resize(fd, 2) != 0);
+	size_t max_size = 1024 * 1024 * 100;
+	unit_check(ufs_resize(fd, max_size) == 0, "resize to max size");
+	char buffer[2048];
+	unit_check(ufs_pread(fd, buffer, 6, 0) == 6 &&
+		   memcmp(buffer, "ab\0\0\0\0", 6) == 0,
+		   "old data behind the shrink is not visible");
+	unit_fail_if(ufs_pread(fd, buffer, sizeof(buffer), 50 * 1024 * 1024) !=
+		     sizeof(buffer));
+	bool is_zero = true;
+	for (int i = 0; i < (int)sizeof(buffer); ++i)
+		is_zero = is_zero && buffer[i] == 0;
+	unit_check(is_zero, "hole is read as zeros");
+	unit_fail_if(ufs_pread(fd, buffer, sizeof(buffer), max_size - 10) != 10);
+
+	unit_fail_if(ufs_pwrite(fd, "x", 1, 50 * 1024 * 1024 + 1000) != 1);
+	unit_fail_if(ufs_pread(fd, buffer, sizeof(buffer), 50 * 1024 * 1024) !=
+		     sizeof(buffer));
+	is_zero = true;
+	for (int i = 0; i < (int)sizeof(buffer); ++i) {
+		if (i != 1000)
+			is_zero = is_zero && buffer[i] == 0;
+	}
+	unit_check(is_zero && buffer[1000] == 'x',
+		   "write into a hole keeps the zeros around");
+
+	struct iovec *iov;
+	int iovcnt;
+	int fd2 = ufs_open("file", 0);
+	unit_fail_if(fd2 == -1);
+	ssize_t rc = ufs_read_view(fd2, 8192, &iov, &iovcnt);
+	unit_fail_if(rc != 8192);
+	size_t pos = 0;
+	is_zero = true;
+	for (int i = 0; i < iovcnt; ++i) {
+		for (size_t j = 0; j < iov[i].iov_len; ++j, ++pos) {
+			if (pos >= 2)
+				is_zero = is_zero &&
+					  ((char *)iov[i].iov_base)[j] == 0;
+		}
+	}
+	unit_check(is_zero && ((char *)iov[0].iov_base)[0] == 'a',
+		   "view of a hole");
+	ufs_release_view(iov, iovcnt);
+	unit_fail_if(ufs_close(fd2) != 0);
+
+	unit_fail_if(ufs_resize(fd, 0) != 0);
+	unit_fail_if(ufs_close(fd) != 0);
+	unit_fail_if(ufs_delete("file") != 0);
+
+	unit_test_finish();
+#endif
+}
+
+static void
+test_clone(void)
+{
+	unit_test_start();
+
+	char data[5000];
+	for (int i = 0; i < (int)sizeof(data); ++i)
+		data[i] = 'a' + i % 26;
+	int fd = ufs_open("file", UFS_CREATE);
+	unit_fail_if(fd == -1);
+	unit_fail_if(ufs_write(fd, data, sizeof(data)) != sizeof(data));
+	unit_check(ufs_clone("file", "copy") == 0, "clone");
+	unit_check(ufs_clone("none", "copy2") == -1 &&
+		   ufs_errno() == UFS_ERR_NO_FILE, "clone of no file");
+
+	int fd2 = ufs_open("copy", 0);
+	unit_fail_if(fd2 == -1);
+	char buffer[6000];
+	unit_check(ufs_read(fd2, buffer, sizeof(buffer)) == sizeof(data) &&
+		   memcmp(buffer, data, sizeof(data)) == 0, "clone data");
+	unit_fail_if(ufs_pwrite(fd, "src", 3, 100) != 3);
+	unit_fail_if(ufs_pwrite(fd2, "dst", 3, 4000) != 3);
+	unit_fail_if(ufs_pread(fd, buffer, sizeof(buffer), 0) != sizeof(data));
+	unit_check(memcmp(buffer + 100, "src", 3) == 0 &&
+		   memcmp(buffer + 4000, data + 4000, 3) == 0,
+		   "source sees only its changes");
+	unit_fail_if(ufs_pread(fd2, buffer, sizeof(buffer), 0) !=
+		     sizeof(data));
+	unit_check(memcmp(buffer + 100, data + 100, 3) == 0 &&
+		   memcmp(buffer + 4000, "dst", 3) == 0,
+		   "clone sees only its changes");
+
+	unit_fail_if(ufs_close(fd) != 0);
+	unit_fail_if(ufs_delete("file") != 0);
+	unit_fail_if(ufs_pread(fd2, buffer, sizeof(buffer), 0) !=
+		     sizeof(data));
+	unit_check(memcmp(buffer, data, 100) == 0,
+		   "clone survives the source deletion");
+	unit_check(ufs_clone("copy", "copy") == 0, "clone into itself");
+	unit_fail_if(ufs_close(fd2) != 0);
+	unit_fail_if(ufs_delete("copy") != 0);
+
+	unit_test_finish();
+}
+
+static void
+test_small_files(void)
+{
+	unit_test_start();
+
+	char data[300];
+	for (int i = 0; i < (int)sizeof(data); ++i)
+		data[i] = 'a' + i % 26;
+	int fd = ufs_open("file", UFS_CREATE);
+	unit_fail_if(fd == -1);
+	unit_fail_if(ufs_write(fd, data, 100) != 100);
+	char buffer[400];
+	unit_check(ufs_pread(fd, buffer, sizeof(buffer), 0) == 100 &&
+		   memcmp(buffer, data, 100) == 0, "small file");
+
+	struct iovec *iov;
+	int iovcnt;
+	int fd2 = ufs_open("file", 0);
+	unit_fail_if(fd2 == -1);
+	unit_fail_if(ufs_read_view(fd2, 100, &iov, &iovcnt) != 100);
+	unit_fail_if(ufs_write(fd, data + 100, 200) != 200);
+	unit_check(ufs_pread(fd, buffer, sizeof(buffer), 0) == 300 &&
+		   memcmp(buffer, data, 300) == 0, "small file grows big");
+	unit_check(iovcnt == 1 && memcmp(iov[0].iov_base, data, 100) == 0,
+		   "view of a small file survives the growth");
+	ufs_release_view(iov, iovcnt);
+	unit_fail_if(ufs_close(fd2) != 0);
+
+#ifdef NEED_RESIZE
+	unit_fail_if(ufs_resize(fd, 0) != 0);
+	unit_fail_if(ufs_pwrite(fd, "xyz", 3, 0) != 3);
+	unit_fail_if(ufs_resize(fd, 20) != 0);
+	unit_check(ufs_pread(fd, buffer, sizeof(buffer), 0) == 20 &&
+		   memcmp(buffer, "xyz\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0",
+			  20) == 0, "big file becomes small again");
+	unit_fail_if(ufs_resize(fd, 1) != 0);
+	unit_fail_if(ufs_resize(fd, 200) != 0);
+	unit_fail_if(ufs_pread(fd, buffer, sizeof(buffer), 0) != 200);
+	bool is_zero = true;
+	for (int i = 1; i < 200; ++i)
+		is_zero = is_zero && buffer[i] == 0;
+	unit_check(buffer[0] == 'x' && is_zero,
+		   "small file shrinks and grows with zeros");
+#endif
+
+	unit_fail_if(ufs_close(fd) != 0);
+	unit_fail_if(ufs_delete("file") != 0);
+
+	unit_test_finish();
+}
+
+static void
+test_seek(void)
+{
+	unit_test_start();
+
+	int fd = ufs_open("file", UFS_CREATE);
+	unit_fail_if(fd == -1);
+	unit_fail_if(ufs_write(fd, "123456", 6) != 6);
+	unit_check(ufs_seek(fd, 0, SEEK_CUR) == 6, "current position");
+	unit_check(ufs_seek(fd, 1, SEEK_SET) == 1, "seek from the start");
+	char buffer[32];
+	unit_check(ufs_read(fd, buffer, 2) == 2 &&
+		   memcmp(buffer, "23", 2) == 0, "read after seek");
+	unit_check(ufs_seek(fd, -1, SEEK_CUR) == 2, "seek back");
+	unit_check(ufs_seek(fd, -2, SEEK_END) == 4, "seek from the end");
+	unit_fail_if(ufs_read(fd, buffer, sizeof(buffer)) != 2);
+	unit_check(ufs_seek(fd, 2, SEEK_END) == 8, "seek behind the end");
+	unit_fail_if(ufs_write(fd, "x", 1) != 1);
+	unit_check(ufs_pread(fd, buffer, sizeof(buffer), 0) == 9 &&
+		   memcmp(buffer, "123456\0\0x", 9) == 0, "gap is zeros");
+	unit_check(ufs_seek(fd, -1, SEEK_SET) == -1 &&
+		   ufs_errno() == UFS_ERR_INVALID_ARG, "negative position");
+	unit_check(ufs_seek(fd, 0, 100) == -1 &&
+		   ufs_errno() == UFS_ERR_INVALID_ARG, "bad whence");
+	unit_fail_if(ufs_close(fd) != 0);
+	unit_check(ufs_seek(fd, 0, SEEK_SET) == -1 &&
+		   ufs_errno() == UFS_ERR_NO_FILE, "seek of closed file");
+	unit_fail_if(ufs_delete("file") != 0);
+
+	unit_test_finish();
+}
+
 int
 main(void)
 {
@@ -454,6 +870,14 @@ main(void)
 	test_max_file_size();
 	test_rights();
 	test_resize();
+	test_positional_io();
+	test_vectored_io();
+	test_read_view();
+	test_snapshot();
+	test_sparse();
+	test_clone();
+	test_small_files();
+	test_seek();
 
 	/* Free the memory to make the memory leak detector happy. */
 	ufs_destroy();
@@ -1,64 +1,204 @@
 #include "userfs.h"
+#include "slab.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <pthread.h>
+#include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 enum {
 	BLOCK_SIZE = 512,
 	MAX_FILE_SIZE = 1024 * 1024 * 100,
+	/**
+	 * Blocks of a file grow geometrically: the first one is BLOCK_SIZE,
+	 * each next one is 2 times bigger, up to MAX_BLOCK_SIZE. All the
+	 * others are MAX_BLOCK_SIZE. So a small file wastes little memory,
+	 * and a big one consists of a few big blocks.
+	 */
+	BLOCK_GROW_COUNT = 12,
+	MAX_BLOCK_SIZE = BLOCK_SIZE << (BLOCK_GROW_COUNT - 1),
+	/** Size of all the growing blocks together. */
+	BLOCK_GROW_AREA_SIZE = BLOCK_SIZE * ((1 << BLOCK_GROW_COUNT) - 1),
+	/**
+	 * Blocks up to BLOCK_SIZE << 6 = 32KB are cut from slabs, one cache
+	 * per size. The bigger ones would fit a slab too few times. They are
+	 * rare and go to malloc.
+	 */
+	BLOCK_SLAB_CLASS_COUNT = 7,
+	/**
+	 * Files up to this size keep the data right in struct file, which
+	 * is 256 bytes then, instead of a 512 bytes block and the block
+	 * array.
+	 */
+	FILE_INLINE_SIZE = 128,
 };
 
-/** Global error code. Set from any function on any error. */
-static enum ufs_error_code ufs_error_code = UFS_ERR_NO_ERR;
+/**
+ * Error code of the current thread. Set from any function on any error.
+ */
+static __thread enum ufs_error_code ufs_error_code = UFS_ERR_NO_ERR;
 
+/** Memory for the read views of the holes. */
+static char zero_memory[MAX_BLOCK_SIZE];
+
+/**
+ * Image file loaded by ufs_load(). It is mapped privately, so the blocks
+ * point right into the mapping, and the kernel copies a page on the first
+ * write into it. The image is unmapped when its last block dies.
+ */
+struct image {
+	void *addr;
+	size_t size;
+	/** How many blocks use the mapping. Atomic, like the block refs. */
+	int refs;
+};
+
+/**
+ * The block header and its memory are one allocation, unless the block lies
+ * in a loaded image. All the blocks except the last one are full, so how many
+ * bytes are occupied follows from the file size.
+ */
 struct block {
-	/** Block memory. */
+	/**
+	 * One reference belongs to each file having the block, and one more
+	 * to each read view pinning it. A block with more than one reference
+	 * is never changed: a write into it makes the file use a copy.
+	 * Atomic, because the views are released without any locks, and the
+	 * files sharing the block are locked separately.
+	 */
+	int refs;
+	/** Size of the block memory. */
+	size_t size;
+	/** Block memory: the data below or a part of the image. */
 	char *memory;
-	/** How many bytes are occupied. */
-	int occupied;
-	/** Next block in the file. */
-	struct block *next;
-	/** Previous block in the file. */
-	struct block *prev;
-
-	/* PUT HERE OTHER MEMBERS */
+	/** Image with the memory, if any. */
+	struct image *image;
+	char data[];
 };
 
 struct file {
-	/** Double-linked list of file blocks. */
-	struct block *block_list;
 	/**
-	 * Last block in the list above for fast access to the end
-	 * of file.
+	 * Array of file blocks. Size and position of each block are known
+	 * from its index, so the block with any offset is found in O(1).
+	 */
+	struct block **blocks;
+	int block_count;
+	int block_capacity;
+	/**
+	 * Protects the blocks, the size and the positions of the descriptors
+	 * opened on the file. Readers of the file don't block each other.
+	 */
+	pthread_rwlock_t lock;
+	/** Descriptors opened on the file. */
+	struct filedesc *descs;
+	/**
+	 * How many file descriptors are opened on the file. Protected by
+	 * the file table lock.
 	 */
-	struct block *last_block;
-	/** How many file descriptors are opened on the file. */
 	int refs;
 	/** File name. */
 	char *name;
-	/** Files are stored in a double-linked list. */
-	struct file *next;
-	struct file *prev;
+	/** Hash of the name. */
+	uint32_t hash;
+	/** Next file in the same bucket of the file table. */
+	struct file *hash_next;
+	/** File size in bytes. */
+	size_t size;
+	/**
+	 * The file is deleted but still has opened descriptors. It is not
+	 * in the file table anymore and dies with the last descriptor.
+	 */
+	bool is_deleted;
+	/**
+	 * Data of a small file, while there are no blocks. The rest of the
+	 * file is a hole then. The bytes behind the file size are always
+	 * zeros, so the file can grow without touching them.
+	 */
+	char inline_data[FILE_INLINE_SIZE];
+};
 
-	/* PUT HERE OTHER MEMBERS */
+/**
+ * Hash table of all the files by name. Collisions are chained via
+ * file->hash_next. The capacity is a power of 2, the table grows when
+ * there are more files than buckets, so the lookup is O(1). The table is
+ * used only by open and delete, the I/O does not touch it.
+ */
+static pthread_mutex_t file_table_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct file **file_table = NULL;
+static int file_table_count = 0;
+static int file_table_capacity = 0;
+
+/**
+ * The header of a slab-allocated block and its memory are one object, like
+ * with malloc.
+ */
+static struct slab_cache block_caches[BLOCK_SLAB_CLASS_COUNT] = {
+	SLAB_CACHE_INITIALIZER(sizeof(struct block) + (BLOCK_SIZE << 0)),
+	SLAB_CACHE_INITIALIZER(sizeof(struct block) + (BLOCK_SIZE << 1)),
+	SLAB_CACHE_INITIALIZER(sizeof(struct block) + (BLOCK_SIZE << 2)),
+	SLAB_CACHE_INITIALIZER(sizeof(struct block) + (BLOCK_SIZE << 3)),
+	SLAB_CACHE_INITIALIZER(sizeof(struct block) + (BLOCK_SIZE << 4)),
+	SLAB_CACHE_INITIALIZER(sizeof(struct block) + (BLOCK_SIZE << 5)),
+	SLAB_CACHE_INITIALIZER(sizeof(struct block) + (BLOCK_SIZE << 6)),
 };
 
-/** List of all files. */
-static struct file *file_list = NULL;
+static struct slab_cache file_cache =
+	SLAB_CACHE_INITIALIZER(sizeof(struct file));
 
 struct filedesc {
 	struct file *file;
+	/** Bitwise combination of open_flags. */
+	int flags;
+	/** Position of the descriptor in the file. */
+	size_t pos;
+	/** Serializes the operations on the same descriptor. */
+	pthread_mutex_t lock;
+	struct fd_shard *shard;
+	/** Neighbours in the list of the file descriptors. */
+	struct filedesc *next_in_file;
+	struct filedesc *prev_in_file;
+};
 
-	/* PUT HERE OTHER MEMBERS */
+enum {
+	FD_SHARD_COUNT = 16,
 };
 
 /**
- * An array of file descriptors. When a file descriptor is
- * created, its pointer drops here. When a file descriptor is
- * closed, its place in this array is set to NULL and can be
- * taken by next ufs_open() call.
+ * The descriptors are spread over shards, each with its own lock. Each thread
+ * opens descriptors in its own shard, so the threads working with their own
+ * descriptors don't compete for one lock. Descriptor number is
+ * slot * FD_SHARD_COUNT + shard index + 1.
+ *
+ * When a file descriptor is created, its pointer drops into the shard array.
+ * When a file descriptor is closed, its place in the array is set to NULL,
+ * pushed into the stack of the free places and is taken by the next
+ * ufs_open() in O(1).
  */
-static struct filedesc **file_descriptors = NULL;
-static int file_descriptor_count = 0;
-static int file_descriptor_capacity = 0;
+struct fd_shard {
+	/**
+	 * Taken for reading during each operation with a descriptor, and
+	 * for writing only to add or remove one.
+	 */
+	pthread_rwlock_t lock;
+	struct filedesc **descs;
+	int count;
+	int capacity;
+	int *free_slots;
+	int free_count;
+};
+
+static struct slab_cache filedesc_cache =
+	SLAB_CACHE_INITIALIZER(sizeof(struct filedesc));
+
+static struct fd_shard fd_shards[FD_SHARD_COUNT] = {
+	[0 ... FD_SHARD_COUNT - 1] = {.lock = PTHREAD_RWLOCK_INITIALIZER},
+};
 
 enum ufs_error_code
 ufs_errno()
@@ -66,61 +206,1200 @@ ufs_errno()
 	return ufs_error_code;
 }
 
+/** FNV-1a. */
+static uint32_t
+file_name_hash(const char *name)
+{
+	uint32_t h = 2166136261u;
+	for (; *name != 0; ++name)
+		h = (h ^ (uint8_t)*name) * 16777619u;
+	return h;
+}
+
+static struct file **
+file_table_bucket(uint32_t hash)
+{
+	return &file_table[hash & (file_table_capacity - 1)];
+}
+
+static struct file *
+file_table_find(const char *name)
+{
+	if (file_table_count == 0)
+		return NULL;
+	uint32_t hash = file_name_hash(name);
+	struct file *f = *file_table_bucket(hash);
+	for (; f != NULL; f = f->hash_next) {
+		if (f->hash == hash && strcmp(f->name, name) == 0)
+			return f;
+	}
+	return NULL;
+}
+
+static void
+file_table_insert(struct file *f)
+{
+	if (file_table_count >= file_table_capacity) {
+		int old_capacity = file_table_capacity;
+		struct file **old_table = file_table;
+		file_table_capacity = old_capacity == 0 ? 16 : old_capacity * 2;
+		file_table = calloc(file_table_capacity, sizeof(*file_table));
+		for (int i = 0; i < old_capacity; ++i) {
+			struct file *next;
+			for (struct file *it = old_table[i]; it != NULL;
+			     it = next) {
+				next = it->hash_next;
+				struct file **b = file_table_bucket(it->hash);
+				it->hash_next = *b;
+				*b = it;
+			}
+		}
+		free(old_table);
+	}
+	struct file **b = file_table_bucket(f->hash);
+	f->hash_next = *b;
+	*b = f;
+	++file_table_count;
+}
+
+static void
+file_table_remove(struct file *f)
+{
+	struct file **it = file_table_bucket(f->hash);
+	while (*it != f)
+		it = &(*it)->hash_next;
+	*it = f->hash_next;
+	--file_table_count;
+}
+
+static struct file *
+file_new(const char *name)
+{
+	struct file *f = slab_alloc(&file_cache);
+	memset(f, 0, sizeof(*f));
+	f->name = strdup(name);
+	f->hash = file_name_hash(name);
+	pthread_rwlock_init(&f->lock, NULL);
+	return f;
+}
+
+static size_t
+block_size(int index)
+{
+	if (index < BLOCK_GROW_COUNT)
+		return (size_t)BLOCK_SIZE << index;
+	return MAX_BLOCK_SIZE;
+}
+
+/** Index of the block with the byte at @a pos and offset of it there. */
+static int
+block_index(size_t pos, size_t *offset)
+{
+	if (pos < BLOCK_GROW_AREA_SIZE) {
+		/* Block k starts at BLOCK_SIZE * (2^k - 1). */
+		size_t n = pos / BLOCK_SIZE + 1;
+		int index = 8 * sizeof(unsigned long) - 1 -
+			    __builtin_clzl(n);
+		*offset = pos - BLOCK_SIZE * (((size_t)1 << index) - 1);
+		return index;
+	}
+	pos -= BLOCK_GROW_AREA_SIZE;
+	*offset = pos % MAX_BLOCK_SIZE;
+	return BLOCK_GROW_COUNT + pos / MAX_BLOCK_SIZE;
+}
+
+/** Offset of the block with the given index from the file start. */
+static size_t
+block_start(int index)
+{
+	if (index < BLOCK_GROW_COUNT)
+		return BLOCK_SIZE * (((size_t)1 << index) - 1);
+	return BLOCK_GROW_AREA_SIZE +
+	       (size_t)(index - BLOCK_GROW_COUNT) * MAX_BLOCK_SIZE;
+}
+
+/** How many blocks a file of the given size has. */
+static int
+block_count_for(size_t size)
+{
+	if (size == 0)
+		return 0;
+	size_t offset;
+	return block_index(size - 1, &offset) + 1;
+}
+
+/** Slab cache for blocks of the given size, or NULL if they are malloced. */
+static struct slab_cache *
+block_cache(size_t size)
+{
+	int class = __builtin_ctzl(size / BLOCK_SIZE);
+	if (class < BLOCK_SLAB_CLASS_COUNT)
+		return &block_caches[class];
+	return NULL;
+}
+
+static struct block *
+block_new(size_t size)
+{
+	struct slab_cache *cache = block_cache(size);
+	struct block *b = cache != NULL ? slab_alloc(cache) :
+			  malloc(sizeof(*b) + size);
+	b->refs = 1;
+	b->size = size;
+	b->memory = b->data;
+	b->image = NULL;
+	return b;
+}
+
+static struct block *
+block_new_in_image(struct image *image, char *memory, size_t size)
+{
+	struct block *b = malloc(sizeof(*b));
+	b->refs = 1;
+	b->size = size;
+	b->memory = memory;
+	b->image = image;
+	__atomic_add_fetch(&image->refs, 1, __ATOMIC_RELAXED);
+	return b;
+}
+
+static void
+image_unref(struct image *image)
+{
+	if (__atomic_sub_fetch(&image->refs, 1, __ATOMIC_ACQ_REL) != 0)
+		return;
+	munmap(image->addr, image->size);
+	free(image);
+}
+
+static void
+block_ref(struct block *b)
+{
+	__atomic_add_fetch(&b->refs, 1, __ATOMIC_RELAXED);
+}
+
+static void
+block_unref(struct block *b)
+{
+	if (__atomic_sub_fetch(&b->refs, 1, __ATOMIC_ACQ_REL) != 0)
+		return;
+	if (b->image != NULL) {
+		image_unref(b->image);
+		free(b);
+		return;
+	}
+	struct slab_cache *cache = block_cache(b->size);
+	if (cache != NULL)
+		slab_free(cache, b);
+	else
+		free(b);
+}
+
+static void
+file_delete(struct file *f)
+{
+	for (int i = 0; i < f->block_count; ++i) {
+		if (f->blocks[i] != NULL)
+			block_unref(f->blocks[i]);
+	}
+	free(f->blocks);
+	free(f->name);
+	pthread_rwlock_destroy(&f->lock);
+	slab_free(&file_cache, f);
+}
+
+/** Block with the given index, or NULL if it is a hole. */
+static struct block *
+file_block(const struct file *f, int index)
+{
+	return index < f->block_count ? f->blocks[index] : NULL;
+}
+
+static bool
+file_is_inline(const struct file *f)
+{
+	return f->block_count == 0;
+}
+
+/**
+ * Make the file able to store @a size bytes. A small file keeps the data
+ * inline while it fits, and moves it into the first block when grows out of
+ * it. Otherwise the block array is made to cover @a size bytes. The new
+ * places are holes, the blocks appear only on write.
+ */
+static void
+file_reserve(struct file *f, size_t size)
+{
+	if (file_is_inline(f) && size <= FILE_INLINE_SIZE)
+		return;
+	int count = block_count_for(size);
+	if (count <= f->block_count)
+		return;
+	bool is_inline = file_is_inline(f);
+	if (count > f->block_capacity) {
+		f->block_capacity = count > f->block_capacity * 2 ?
+				    count : f->block_capacity * 2;
+		f->blocks = realloc(f->blocks,
+				    sizeof(*f->blocks) * f->block_capacity);
+	}
+	memset(f->blocks + f->block_count, 0,
+	       sizeof(*f->blocks) * (count - f->block_count));
+	f->block_count = count;
+	if (is_inline && f->size > 0) {
+		size_t len = f->size < FILE_INLINE_SIZE ?
+			     f->size : FILE_INLINE_SIZE;
+		struct block *b = block_new(block_size(0));
+		memcpy(b->memory, f->inline_data, len);
+		memset(b->memory + len, 0, b->size - len);
+		/* Zeros for the next time the file is inline. */
+		memset(f->inline_data, 0, len);
+		f->blocks[0] = b;
+	}
+}
+
+/** Free the blocks or the inline data not needed for @a size bytes. */
+static void
+file_shrink(struct file *f, size_t size)
+{
+	if (file_is_inline(f)) {
+		if (size < FILE_INLINE_SIZE && size < f->size) {
+			size_t end = f->size < FILE_INLINE_SIZE ?
+				     f->size : FILE_INLINE_SIZE;
+			memset(f->inline_data + size, 0, end - size);
+		}
+		return;
+	}
+	int count = block_count_for(size);
+	for (int i = count; i < f->block_count; ++i) {
+		if (f->blocks[i] != NULL)
+			block_unref(f->blocks[i]);
+	}
+	if (count < f->block_count)
+		f->block_count = count;
+}
+
+/**
+ * Get the block for a change of @a size bytes from @a offset. A hole turns
+ * into a new block with zeros around the change. If the block is pinned by a
+ * read view or shared with a clone, the file switches to a copy of it, and
+ * the others keep the old data. The references to the block from this file
+ * can't appear meanwhile, because the views and the clones are made under
+ * the file read lock, and the changes are done under the write lock. The
+ * block array has to cover the block.
+ */
+static struct block *
+file_block_for_write(struct file *f, int index, size_t offset, size_t size)
+{
+	struct block *b = f->blocks[index];
+	if (b == NULL) {
+		b = block_new(block_size(index));
+		if (size > b->size - offset)
+			size = b->size - offset;
+		memset(b->memory, 0, offset);
+		memset(b->memory + offset + size, 0, b->size - offset - size);
+		f->blocks[index] = b;
+		return b;
+	}
+	if (__atomic_load_n(&b->refs, __ATOMIC_ACQUIRE) == 1)
+		return b;
+	struct block *copy = block_new(b->size);
+	memcpy(copy->memory, b->memory, b->size);
+	f->blocks[index] = copy;
+	block_unref(b);
+	return copy;
+}
+
+/**
+ * file_copy() for an inline file. The data behind the inline area is read as
+ * zeros. For writing the data has to fit the inline area.
+ */
+static void
+file_copy_inline(struct file *f, size_t pos, const struct iovec *iov,
+		 int iovcnt, size_t size, bool is_write)
+{
+	for (int i = 0; i < iovcnt && size > 0; ++i) {
+		char *buf = iov[i].iov_base;
+		size_t len = iov[i].iov_len;
+		if (len > size)
+			len = size;
+		size_t inline_len = 0;
+		if (pos < FILE_INLINE_SIZE) {
+			inline_len = FILE_INLINE_SIZE - pos;
+			if (inline_len > len)
+				inline_len = len;
+		}
+		if (is_write) {
+			memcpy(f->inline_data + pos, buf, inline_len);
+		} else {
+			memcpy(buf, f->inline_data + pos, inline_len);
+			memset(buf + inline_len, 0, len - inline_len);
+		}
+		pos += len;
+		size -= len;
+	}
+}
+
+/**
+ * Copy between the file starting from @a pos and the buffers of @a iov. The
+ * holes are read as zeros. For writing the block array has to cover the
+ * data. The blocks and the buffers are walked together, so the block of
+ * @a pos is looked up only once for the whole vector.
+ */
+static void
+file_copy(struct file *f, size_t pos, const struct iovec *iov, int iovcnt,
+	  size_t size, bool is_write)
+{
+	if (file_is_inline(f)) {
+		file_copy_inline(f, pos, iov, iovcnt, size, is_write);
+		return;
+	}
+	size_t offset;
+	int index = block_index(pos, &offset);
+	struct block *b = NULL;
+	size_t bsize = 0;
+	for (int i = 0; i < iovcnt && size > 0; ++i) {
+		char *buf = iov[i].iov_base;
+		size_t buf_size = iov[i].iov_len;
+		while (buf_size > 0 && size > 0) {
+			if (bsize == 0 || offset == bsize) {
+				if (bsize != 0) {
+					offset = 0;
+					++index;
+				}
+				bsize = block_size(index);
+				if (is_write) {
+					b = file_block_for_write(f, index,
+								 offset, size);
+				} else {
+					b = file_block(f, index);
+				}
+			}
+			size_t len = bsize - offset;
+			if (len > buf_size)
+				len = buf_size;
+			if (len > size)
+				len = size;
+			if (is_write)
+				memcpy(b->memory + offset, buf, len);
+			else if (b != NULL)
+				memcpy(buf, b->memory + offset, len);
+			else
+				memset(buf, 0, len);
+			buf += len;
+			buf_size -= len;
+			size -= len;
+			offset += len;
+		}
+	}
+}
+
+/**
+ * Fill the file with zeros from @a pos. Only the existing blocks are
+ * touched, the holes and the places behind the block array are zeros
+ * anyway.
+ */
+static void
+file_zero(struct file *f, size_t pos, size_t size)
+{
+	size_t offset;
+	int index = block_index(pos, &offset);
+	for (; size > 0 && index < f->block_count; ++index, offset = 0) {
+		size_t len = block_size(index) - offset;
+		if (len > size)
+			len = size;
+		if (f->blocks[index] != NULL) {
+			struct block *b = file_block_for_write(f, index,
+							       offset, len);
+			memset(b->memory + offset, 0, len);
+		}
+		size -= len;
+	}
+}
+
+static struct fd_shard *
+fd_shard_of(int fd, int *slot)
+{
+	/* The descriptors start from 1, ufs_open() returns > 0. */
+	if (fd <= 0) {
+		ufs_error_code = UFS_ERR_NO_FILE;
+		return NULL;
+	}
+	*slot = (fd - 1) / FD_SHARD_COUNT;
+	return &fd_shards[(fd - 1) % FD_SHARD_COUNT];
+}
+
+/**
+ * Find the descriptor and lock it for an operation. Its shard stays
+ * read-locked until filedesc_release(), so the descriptor can't be closed
+ * meanwhile.
+ */
+static struct filedesc *
+filedesc_acquire(int fd)
+{
+	int slot;
+	struct fd_shard *shard = fd_shard_of(fd, &slot);
+	if (shard == NULL)
+		return NULL;
+	pthread_rwlock_rdlock(&shard->lock);
+	if (slot >= shard->count || shard->descs[slot] == NULL) {
+		pthread_rwlock_unlock(&shard->lock);
+		ufs_error_code = UFS_ERR_NO_FILE;
+		return NULL;
+	}
+	struct filedesc *desc = shard->descs[slot];
+	pthread_mutex_lock(&desc->lock);
+	return desc;
+}
+
+static void
+filedesc_release(struct filedesc *desc)
+{
+	pthread_mutex_unlock(&desc->lock);
+	pthread_rwlock_unlock(&desc->shard->lock);
+}
+
+/** Shard for the descriptors opened by the current thread. */
+static struct fd_shard *
+fd_shard_current(void)
+{
+	static int next_shard = 0;
+	static __thread int thread_shard = -1;
+	if (thread_shard < 0) {
+		thread_shard = __atomic_fetch_add(&next_shard, 1,
+			__ATOMIC_RELAXED) % FD_SHARD_COUNT;
+	}
+	return &fd_shards[thread_shard];
+}
+
 int
 ufs_open(const char *filename, int flags)
 {
-	/* IMPLEMENT THIS FUNCTION */
-	(void)filename;
-	(void)flags;
-	(void)file_list;
-	(void)file_descriptors;
-	(void)file_descriptor_count;
-	(void)file_descriptor_capacity;
-	ufs_error_code = UFS_ERR_NOT_IMPLEMENTED;
-	return -1;
+	pthread_mutex_lock(&file_table_lock);
+	struct file *f = file_table_find(filename);
+	if (f == NULL) {
+		if ((flags & UFS_CREATE) == 0) {
+			pthread_mutex_unlock(&file_table_lock);
+			ufs_error_code = UFS_ERR_NO_FILE;
+			return -1;
+		}
+		f = file_new(filename);
+		file_table_insert(f);
+	}
+	/* The reference keeps the file alive after the unlock. */
+	++f->refs;
+	pthread_mutex_unlock(&file_table_lock);
+
+	struct fd_shard *shard = fd_shard_current();
+	struct filedesc *desc = slab_alloc(&filedesc_cache);
+	desc->file = f;
+	desc->flags = flags;
+	desc->pos = 0;
+	desc->shard = shard;
+	pthread_mutex_init(&desc->lock, NULL);
+	pthread_rwlock_wrlock(&f->lock);
+	desc->prev_in_file = NULL;
+	desc->next_in_file = f->descs;
+	if (f->descs != NULL)
+		f->descs->prev_in_file = desc;
+	f->descs = desc;
+	pthread_rwlock_unlock(&f->lock);
+
+	pthread_rwlock_wrlock(&shard->lock);
+	int slot;
+	if (shard->free_count > 0) {
+		slot = shard->free_slots[--shard->free_count];
+	} else {
+		if (shard->count == shard->capacity) {
+			shard->capacity = (shard->capacity + 1) * 2;
+			shard->descs = realloc(shard->descs,
+				sizeof(*shard->descs) * shard->capacity);
+			shard->free_slots = realloc(shard->free_slots,
+				sizeof(*shard->free_slots) * shard->capacity);
+		}
+		slot = shard->count++;
+	}
+	shard->descs[slot] = desc;
+	pthread_rwlock_unlock(&shard->lock);
+	return slot * FD_SHARD_COUNT + (shard - fd_shards) + 1;
+}
+
+static bool
+filedesc_can_read(const struct filedesc *desc)
+{
+	return (desc->flags & UFS_WRITE_ONLY) == 0;
+}
+
+static bool
+filedesc_can_write(const struct filedesc *desc)
+{
+	return (desc->flags & UFS_READ_ONLY) == 0;
+}
+
+/** Total size of the buffers, or SIZE_MAX if it is bigger than any file. */
+static size_t
+iov_size(const struct iovec *iov, int iovcnt)
+{
+	size_t size = 0;
+	for (int i = 0; i < iovcnt; ++i) {
+		if (iov[i].iov_len > MAX_FILE_SIZE - size)
+			return SIZE_MAX;
+		size += iov[i].iov_len;
+	}
+	return size;
+}
+
+/**
+ * Write the buffers into the file at @a pos, or at the descriptor position
+ * moving it if @a pos is NULL. A gap between the file end and the written
+ * data is filled with zeros.
+ */
+static ssize_t
+filedesc_writev(int fd, const struct iovec *iov, int iovcnt, const size_t *pos)
+{
+	struct filedesc *desc = filedesc_acquire(fd);
+	if (desc == NULL)
+		return -1;
+	ssize_t rc = -1;
+	if (!filedesc_can_write(desc)) {
+		ufs_error_code = UFS_ERR_NO_PERMISSION;
+		goto release;
+	}
+	struct file *f = desc->file;
+	size_t size = iov_size(iov, iovcnt);
+	/* Like in POSIX, an empty write does not grow the file. */
+	if (size == 0) {
+		rc = 0;
+		goto release;
+	}
+	pthread_rwlock_wrlock(&f->lock);
+	size_t start = pos != NULL ? *pos : desc->pos;
+	if (size > MAX_FILE_SIZE || start > MAX_FILE_SIZE - size) {
+		ufs_error_code = UFS_ERR_NO_MEM;
+	} else {
+		file_reserve(f, start + size);
+		if (start > f->size)
+			file_zero(f, f->size, start - f->size);
+		file_copy(f, start, iov, iovcnt, size, true);
+		if (pos == NULL)
+			desc->pos = start + size;
+		if (start + size > f->size)
+			f->size = start + size;
+		rc = size;
+	}
+	pthread_rwlock_unlock(&f->lock);
+release:
+	filedesc_release(desc);
+	return rc;
+}
+
+/**
+ * Read the file into the buffers from @a pos, or from the descriptor position
+ * moving it if @a pos is NULL.
+ */
+static ssize_t
+filedesc_readv(int fd, const struct iovec *iov, int iovcnt, const size_t *pos)
+{
+	struct filedesc *desc = filedesc_acquire(fd);
+	if (desc == NULL)
+		return -1;
+	if (!filedesc_can_read(desc)) {
+		filedesc_release(desc);
+		ufs_error_code = UFS_ERR_NO_PERMISSION;
+		return -1;
+	}
+	struct file *f = desc->file;
+	size_t size = iov_size(iov, iovcnt);
+	pthread_rwlock_rdlock(&f->lock);
+	size_t start = pos != NULL ? *pos : desc->pos;
+	if (start >= f->size)
+		size = 0;
+	else if (size > f->size - start)
+		size = f->size - start;
+	file_copy(f, start, iov, iovcnt, size, false);
+	if (pos == NULL)
+		desc->pos = start + size;
+	pthread_rwlock_unlock(&f->lock);
+	filedesc_release(desc);
+	return size;
 }
 
 ssize_t
 ufs_write(int fd, const char *buf, size_t size)
 {
-	/* IMPLEMENT THIS FUNCTION */
-	(void)fd;
-	(void)buf;
-	(void)size;
-	ufs_error_code = UFS_ERR_NOT_IMPLEMENTED;
-	return -1;
+	struct iovec iov = {.iov_base = (char *)buf, .iov_len = size};
+	return filedesc_writev(fd, &iov, 1, NULL);
 }
 
 ssize_t
 ufs_read(int fd, char *buf, size_t size)
 {
-	/* IMPLEMENT THIS FUNCTION */
-	(void)fd;
-	(void)buf;
-	(void)size;
-	ufs_error_code = UFS_ERR_NOT_IMPLEMENTED;
-	return -1;
+	struct iovec iov = {.iov_base = buf, .iov_len = size};
+	return filedesc_readv(fd, &iov, 1, NULL);
+}
+
+ssize_t
+ufs_pwrite(int fd, const char *buf, size_t size, size_t offset)
+{
+	struct iovec iov = {.iov_base = (char *)buf, .iov_len = size};
+	return filedesc_writev(fd, &iov, 1, &offset);
+}
+
+ssize_t
+ufs_pread(int fd, char *buf, size_t size, size_t offset)
+{
+	struct iovec iov = {.iov_base = buf, .iov_len = size};
+	return filedesc_readv(fd, &iov, 1, &offset);
+}
+
+ssize_t
+ufs_writev(int fd, const struct iovec *iov, int iovcnt)
+{
+	return filedesc_writev(fd, iov, iovcnt, NULL);
+}
+
+ssize_t
+ufs_readv(int fd, const struct iovec *iov, int iovcnt)
+{
+	return filedesc_readv(fd, iov, iovcnt, NULL);
+}
+
+off_t
+ufs_seek(int fd, off_t offset, int whence)
+{
+	struct filedesc *desc = filedesc_acquire(fd);
+	if (desc == NULL)
+		return -1;
+	struct file *f = desc->file;
+	/* The positions change under the file lock, see ufs_resize(). */
+	pthread_rwlock_rdlock(&f->lock);
+	off_t base = -1;
+	if (whence == SEEK_SET)
+		base = 0;
+	else if (whence == SEEK_CUR)
+		base = desc->pos;
+	else if (whence == SEEK_END)
+		base = f->size;
+	off_t rc = -1;
+	if (base < 0 || offset < -base || offset > INT64_MAX - base) {
+		ufs_error_code = UFS_ERR_INVALID_ARG;
+	} else {
+		desc->pos = base + offset;
+		rc = desc->pos;
+	}
+	pthread_rwlock_unlock(&f->lock);
+	filedesc_release(desc);
+	return rc;
+}
+
+ssize_t
+ufs_read_view(int fd, size_t size, struct iovec **iov, int *iovcnt)
+{
+	*iov = NULL;
+	*iovcnt = 0;
+	struct filedesc *desc = filedesc_acquire(fd);
+	if (desc == NULL)
+		return -1;
+	if (!filedesc_can_read(desc)) {
+		filedesc_release(desc);
+		ufs_error_code = UFS_ERR_NO_PERMISSION;
+		return -1;
+	}
+	struct file *f = desc->file;
+	pthread_rwlock_rdlock(&f->lock);
+	if (desc->pos >= f->size)
+		size = 0;
+	else if (size > f->size - desc->pos)
+		size = f->size - desc->pos;
+	if (size == 0)
+		goto unlock;
+	size_t offset, last_offset;
+	int index = block_index(desc->pos, &offset);
+	int count = block_index(desc->pos + size - 1, &last_offset) - index + 1;
+	/*
+	 * The pinned blocks are stored right behind the buffers to find them
+	 * on release.
+	 */
+	struct iovec *views = malloc((sizeof(*views) + sizeof(struct block *)) *
+				     count);
+	struct block **pinned = (struct block **)(views + count);
+	size_t left = size;
+	for (int i = 0; i < count; ++i, offset = 0) {
+		size_t len = block_size(index + i) - offset;
+		if (len > left)
+			len = left;
+		struct block *b = file_block(f, index + i);
+		if (b != NULL) {
+			block_ref(b);
+		} else if (index + i == 0 && file_is_inline(f)) {
+			/*
+			 * The inline data dies with the file, so the view
+			 * gets a copy of it. It is small anyway.
+			 */
+			b = block_new(block_size(0));
+			memcpy(b->memory, f->inline_data, FILE_INLINE_SIZE);
+			memset(b->memory + FILE_INLINE_SIZE, 0,
+			       b->size - FILE_INLINE_SIZE);
+		}
+		pinned[i] = b;
+		if (b != NULL) {
+			views[i].iov_base = b->memory + offset;
+		} else {
+			views[i].iov_base = (char *)zero_memory;
+		}
+		views[i].iov_len = len;
+		left -= len;
+	}
+	desc->pos += size;
+	*iov = views;
+	*iovcnt = count;
+unlock:
+	pthread_rwlock_unlock(&f->lock);
+	filedesc_release(desc);
+	return size;
+}
+
+void
+ufs_release_view(struct iovec *iov, int iovcnt)
+{
+	if (iov == NULL)
+		return;
+	struct block **pinned = (struct block **)(iov + iovcnt);
+	for (int i = 0; i < iovcnt; ++i) {
+		if (pinned[i] != NULL)
+			block_unref(pinned[i]);
+	}
+	free(iov);
+}
+
+/** Drop a file reference. The last one deletes a deleted file. */
+static void
+file_unref(struct file *f)
+{
+	pthread_mutex_lock(&file_table_lock);
+	bool is_dead = --f->refs == 0 && f->is_deleted;
+	pthread_mutex_unlock(&file_table_lock);
+	if (is_dead)
+		file_delete(f);
 }
 
 int
 ufs_close(int fd)
 {
-	/* IMPLEMENT THIS FUNCTION */
-	(void)fd;
-	ufs_error_code = UFS_ERR_NOT_IMPLEMENTED;
-	return -1;
+	int slot;
+	struct fd_shard *shard = fd_shard_of(fd, &slot);
+	if (shard == NULL)
+		return -1;
+	pthread_rwlock_wrlock(&shard->lock);
+	if (slot >= shard->count || shard->descs[slot] == NULL) {
+		pthread_rwlock_unlock(&shard->lock);
+		ufs_error_code = UFS_ERR_NO_FILE;
+		return -1;
+	}
+	struct filedesc *desc = shard->descs[slot];
+	shard->descs[slot] = NULL;
+	shard->free_slots[shard->free_count++] = slot;
+	pthread_rwlock_unlock(&shard->lock);
+
+	struct file *f = desc->file;
+	pthread_rwlock_wrlock(&f->lock);
+	if (desc->prev_in_file != NULL)
+		desc->prev_in_file->next_in_file = desc->next_in_file;
+	else
+		f->descs = desc->next_in_file;
+	if (desc->next_in_file != NULL)
+		desc->next_in_file->prev_in_file = desc->prev_in_file;
+	pthread_rwlock_unlock(&f->lock);
+	file_unref(f);
+	pthread_mutex_destroy(&desc->lock);
+	slab_free(&filedesc_cache, desc);
+	return 0;
+}
+
+/**
+ * Remove the file from the file table. It dies now or with the last
+ * descriptor. Must be called under the file table lock.
+ */
+static void
+file_table_drop(struct file *f)
+{
+	file_table_remove(f);
+	f->is_deleted = true;
+	if (f->refs == 0)
+		file_delete(f);
 }
 
 int
 ufs_delete(const char *filename)
 {
-	/* IMPLEMENT THIS FUNCTION */
-	(void)filename;
-	ufs_error_code = UFS_ERR_NOT_IMPLEMENTED;
-	return -1;
+	pthread_mutex_lock(&file_table_lock);
+	struct file *f = file_table_find(filename);
+	if (f == NULL) {
+		pthread_mutex_unlock(&file_table_lock);
+		ufs_error_code = UFS_ERR_NO_FILE;
+		return -1;
+	}
+	file_table_drop(f);
+	pthread_mutex_unlock(&file_table_lock);
+	return 0;
+}
+
+int
+ufs_clone(const char *src_name, const char *dst_name)
+{
+	pthread_mutex_lock(&file_table_lock);
+	struct file *src = file_table_find(src_name);
+	if (src == NULL) {
+		pthread_mutex_unlock(&file_table_lock);
+		ufs_error_code = UFS_ERR_NO_FILE;
+		return -1;
+	}
+	if (strcmp(src_name, dst_name) == 0) {
+		pthread_mutex_unlock(&file_table_lock);
+		return 0;
+	}
+	struct file *old = file_table_find(dst_name);
+	if (old != NULL)
+		file_table_drop(old);
+	struct file *f = file_new(dst_name);
+	/*
+	 * The blocks are shared. The first write into a shared block makes
+	 * the writer switch to a copy of it, like with the read views.
+	 */
+	pthread_rwlock_rdlock(&src->lock);
+	if (file_is_inline(src)) {
+		memcpy(f->inline_data, src->inline_data, FILE_INLINE_SIZE);
+	} else {
+		f->blocks = malloc(sizeof(*f->blocks) * src->block_count);
+		f->block_count = src->block_count;
+		f->block_capacity = src->block_count;
+	}
+	for (int i = 0; i < src->block_count; ++i) {
+		f->blocks[i] = src->blocks[i];
+		if (f->blocks[i] != NULL)
+			block_ref(f->blocks[i]);
+	}
+	f->size = src->size;
+	pthread_rwlock_unlock(&src->lock);
+	file_table_insert(f);
+	pthread_mutex_unlock(&file_table_lock);
+	return 0;
+}
+
+int
+ufs_resize(int fd, size_t new_size)
+{
+	struct filedesc *desc = filedesc_acquire(fd);
+	if (desc == NULL)
+		return -1;
+	if (!filedesc_can_write(desc)) {
+		filedesc_release(desc);
+		ufs_error_code = UFS_ERR_NO_PERMISSION;
+		return -1;
+	}
+	if (new_size > MAX_FILE_SIZE) {
+		filedesc_release(desc);
+		ufs_error_code = UFS_ERR_NO_MEM;
+		return -1;
+	}
+	struct file *f = desc->file;
+	pthread_rwlock_wrlock(&f->lock);
+	if (new_size >= f->size) {
+		/*
+		 * New space is zeros. Only the tail of the last block can
+		 * have old data, the rest is holes, so it is O(1).
+		 */
+		file_zero(f, f->size, new_size - f->size);
+	} else {
+		file_shrink(f, new_size);
+		/*
+		 * The descriptors behind the new end continue from the end.
+		 * Their positions change only under the file lock, so it is
+		 * safe to touch them here.
+		 */
+		for (struct filedesc *d = f->descs; d != NULL;
+		     d = d->next_in_file) {
+			if (d->pos > new_size)
+				d->pos = new_size;
+		}
+	}
+	f->size = new_size;
+	pthread_rwlock_unlock(&f->lock);
+	filedesc_release(desc);
+	return 0;
+}
+
+enum {
+	IMAGE_VERSION = 1,
+	/** Alignment of each file data in the image. */
+	IMAGE_ALIGN = 16,
+};
+
+static const char image_magic[8] = "UFSIMAGE";
+
+/**
+ * The image is the superblock, then the file table, then the file names,
+ * then the data of all the files. The data of each file is contiguous and
+ * laid out exactly like its blocks, so the loaded blocks just point into the
+ * mapped image. The data of each file takes the whole capacity of its blocks,
+ * so a write into the last loaded block never reaches the next file. The
+ * padding is a hole in the image file. The numbers are in the host byte
+ * order.
+ */
+struct image_super {
+	char magic[8];
+	uint32_t version;
+	uint32_t file_count;
+	/** Size of the whole image file. */
+	uint64_t size;
+	/** Offset of the file names, right after the file table. */
+	uint64_t names_offset;
+};
+
+struct image_file {
+	/** Offset of the file data from the image start. */
+	uint64_t data_offset;
+	uint64_t size;
+	/** Offset of the name from the names start. Zero terminated. */
+	uint64_t name_offset;
+};
+
+static size_t
+image_align(size_t size)
+{
+	return (size + IMAGE_ALIGN - 1) & ~(size_t)(IMAGE_ALIGN - 1);
+}
+
+static bool
+write_at(int fd, const void *buf, size_t size, off_t offset)
+{
+	while (size > 0) {
+		ssize_t rc = pwrite(fd, buf, size, offset);
+		if (rc < 0)
+			return false;
+		buf = (const char *)buf + rc;
+		size -= rc;
+		offset += rc;
+	}
+	return true;
+}
+
+int
+ufs_snapshot(const char *path)
+{
+	/*
+	 * The image is written aside and then renamed. The old image can be
+	 * mapped by ufs_load(), and truncating it would break the mapping.
+	 */
+	size_t path_len = strlen(path);
+	char *tmp_path = malloc(path_len + sizeof(".tmp"));
+	memcpy(tmp_path, path, path_len);
+	memcpy(tmp_path + path_len, ".tmp", sizeof(".tmp"));
+	int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		free(tmp_path);
+		ufs_error_code = UFS_ERR_IO;
+		return -1;
+	}
+	/*
+	 * The table lock keeps the set of files. Each file is read-locked
+	 * only while its data is written, so the snapshot is consistent per
+	 * file, and the I/O with the other files goes on meanwhile.
+	 */
+	pthread_mutex_lock(&file_table_lock);
+	struct image_file *table = calloc(file_table_count + 1, sizeof(*table));
+	size_t names_size = 0;
+	int count = 0;
+	for (int i = 0; i < file_table_capacity; ++i) {
+		for (struct file *f = file_table[i]; f != NULL;
+		     f = f->hash_next) {
+			table[count++].name_offset = names_size;
+			names_size += strlen(f->name) + 1;
+		}
+	}
+	size_t names_offset = sizeof(struct image_super) +
+			      sizeof(*table) * count;
+	size_t pos = image_align(names_offset + names_size);
+	bool ok = true;
+	count = 0;
+	for (int i = 0; i < file_table_capacity && ok; ++i) {
+		for (struct file *f = file_table[i]; f != NULL && ok;
+		     f = f->hash_next) {
+			struct image_file *entry = &table[count++];
+			ok = write_at(fd, f->name, strlen(f->name) + 1,
+				      names_offset + entry->name_offset);
+			pthread_rwlock_rdlock(&f->lock);
+			entry->data_offset = pos;
+			entry->size = f->size;
+			if (file_is_inline(f)) {
+				ok = write_at(fd, f->inline_data,
+					      f->size < FILE_INLINE_SIZE ?
+					      f->size : FILE_INLINE_SIZE, pos);
+			}
+			/* The holes stay holes in the image. */
+			for (size_t done = 0; done < f->size && ok;) {
+				size_t offset;
+				int index = block_index(done, &offset);
+				struct block *b = file_block(f, index);
+				size_t len = block_size(index);
+				if (len > f->size - done)
+					len = f->size - done;
+				if (b != NULL)
+					ok = write_at(fd, b->memory, len,
+						      pos + done);
+				done += len;
+			}
+			pos += image_align(block_start(block_count_for(
+				f->size)));
+			pthread_rwlock_unlock(&f->lock);
+		}
+	}
+	pthread_mutex_unlock(&file_table_lock);
+	struct image_super super;
+	memcpy(super.magic, image_magic, sizeof(super.magic));
+	super.version = IMAGE_VERSION;
+	super.file_count = count;
+	super.size = pos;
+	super.names_offset = names_offset;
+	ok = ok && write_at(fd, table, sizeof(*table) * count, sizeof(super)) &&
+	     write_at(fd, &super, sizeof(super), 0) && ftruncate(fd, pos) == 0;
+	free(table);
+	ok = close(fd) == 0 && ok && rename(tmp_path, path) == 0;
+	if (!ok)
+		unlink(tmp_path);
+	free(tmp_path);
+	if (!ok) {
+		ufs_error_code = UFS_ERR_IO;
+		return -1;
+	}
+	return 0;
+}
+
+/** Check that the image is not damaged, so it can be trusted on load. */
+static bool
+image_is_valid(const char *addr, size_t size)
+{
+	const struct image_super *super = (const void *)addr;
+	if (size < sizeof(*super) ||
+	    memcmp(super->magic, image_magic, sizeof(super->magic)) != 0 ||
+	    super->version != IMAGE_VERSION || super->size != size)
+		return false;
+	if (super->names_offset != sizeof(*super) +
+	    sizeof(struct image_file) * (uint64_t)super->file_count ||
+	    super->names_offset > size)
+		return false;
+	const struct image_file *table = (const void *)(super + 1);
+	for (uint32_t i = 0; i < super->file_count; ++i) {
+		const struct image_file *entry = &table[i];
+		if (entry->size > MAX_FILE_SIZE ||
+		    entry->data_offset % IMAGE_ALIGN != 0 ||
+		    entry->data_offset > size ||
+		    block_start(block_count_for(entry->size)) >
+		    size - entry->data_offset)
+			return false;
+		if (entry->name_offset >= size - super->names_offset)
+			return false;
+		const char *name = addr + super->names_offset +
+				   entry->name_offset;
+		if (memchr(name, 0, addr + size - name) == NULL)
+			return false;
+	}
+	return true;
+}
+
+int
+ufs_load(const char *path)
+{
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		ufs_error_code = UFS_ERR_IO;
+		return -1;
+	}
+	struct stat st;
+	char *addr = MAP_FAILED;
+	if (fstat(fd, &st) == 0 && st.st_size > 0) {
+		addr = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE,
+			    MAP_PRIVATE, fd, 0);
+	}
+	close(fd);
+	if (addr == MAP_FAILED) {
+		ufs_error_code = UFS_ERR_IO;
+		return -1;
+	}
+	if (!image_is_valid(addr, st.st_size)) {
+		munmap(addr, st.st_size);
+		ufs_error_code = UFS_ERR_IO;
+		return -1;
+	}
+	struct image *image = malloc(sizeof(*image));
+	image->addr = addr;
+	image->size = st.st_size;
+	/* Held during the load not to die with no files. */
+	image->refs = 1;
+	const struct image_super *super = (const void *)addr;
+	const struct image_file *table = (const void *)(super + 1);
+	pthread_mutex_lock(&file_table_lock);
+	for (uint32_t i = 0; i < super->file_count; ++i) {
+		const struct image_file *entry = &table[i];
+		const char *name = addr + super->names_offset +
+				   entry->name_offset;
+		/* The loaded file replaces the one with the same name. */
+		struct file *old = file_table_find(name);
+		if (old != NULL)
+			file_table_drop(old);
+		struct file *f = file_new(name);
+		int count = block_count_for(entry->size);
+		f->blocks = malloc(sizeof(*f->blocks) * count);
+		f->block_count = count;
+		f->block_capacity = count;
+		for (int j = 0; j < count; ++j) {
+			f->blocks[j] = block_new_in_image(image,
+				addr + entry->data_offset + block_start(j),
+				block_size(j));
+		}
+		f->size = entry->size;
+		file_table_insert(f);
+	}
+	pthread_mutex_unlock(&file_table_lock);
+	image_unref(image);
+	return 0;
 }
 
 void
 ufs_destroy(void)
 {
+	for (int i = 0; i < FD_SHARD_COUNT; ++i) {
+		struct fd_shard *shard = &fd_shards[i];
+		for (int j = 0; j < shard->count; ++j) {
+			struct filedesc *desc = shard->descs[j];
+			if (desc == NULL)
+				continue;
+			struct file *f = desc->file;
+			if (--f->refs == 0 && f->is_deleted)
+				file_delete(f);
+			pthread_mutex_destroy(&desc->lock);
+			slab_free(&filedesc_cache, desc);
+		}
+		free(shard->descs);
+		free(shard->free_slots);
+		shard->descs = NULL;
+		shard->free_slots = NULL;
+		shard->count = 0;
+		shard->capacity = 0;
+		shard->free_count = 0;
+	}
+	for (int i = 0; i < file_table_capacity; ++i) {
+		struct file *next;
+		for (struct file *f = file_table[i]; f != NULL; f = next) {
+			next = f->hash_next;
+			file_delete(f);
+		}
+	}
+	free(file_table);
+	file_table = NULL;
+	file_table_count = 0;
+	file_table_capacity = 0;
+	for (int i = 0; i < BLOCK_SLAB_CLASS_COUNT; ++i)
+		slab_cache_destroy(&block_caches[i]);
+	slab_cache_destroy(&file_cache);
+	slab_cache_destroy(&filedesc_cache);
 }
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <sys/types.h>
+#include <sys/uio.h>
 
 /**
  * User-defined in-memory filesystem. It is as simple as possible.
@@ -24,6 +25,9 @@
  * because it is used by tests.
  */
 
+#define NEED_OPEN_FLAGS
+#define NEED_RESIZE
+
 /**
  * Flags for ufs_open call.
  */
@@ -65,6 +69,9 @@ enum ufs_error_code {
 
 	UFS_ERR_NO_PERMISSION,
 #endif
+	/** The image file can't be read or written, or it is damaged. */
+	UFS_ERR_IO,
+	UFS_ERR_INVALID_ARG,
 };
 
 /** Get code of the last error. */
@@ -112,6 +119,113 @@ ufs_write(int fd, const char *buf, size_t size);
 ssize_t
 ufs_read(int fd, char *buf, size_t size);
 
+/**
+ * Write data to the file at the given offset. The descriptor position is not
+ * changed. If @a offset is behind the file end, the gap is filled with zeros.
+ * @param fd File descriptor from ufs_open().
+ * @param buf Buffer to write.
+ * @param size Size of @a buf.
+ * @param offset Offset in the file to write at.
+ *
+ * @retval >= 0 How many bytes were written.
+ * @retval -1 Error occurred. Check ufs_errno() for a code.
+ *     - UFS_ERR_NO_FILE - invalid file descriptor.
+ *     - UFS_ERR_NO_MEM - not enough memory.
+ */
+ssize_t
+ufs_pwrite(int fd, const char *buf, size_t size, size_t offset);
+
+/**
+ * Read data from the file at the given offset. The descriptor position is not
+ * changed.
+ * @param fd File descriptor from ufs_open().
+ * @param buf Buffer to read into.
+ * @param size Maximum bytes to read.
+ * @param offset Offset in the file to read from.
+ *
+ * @retval > 0 How many bytes were read.
+ * @retval 0 EOF.
+ * @retval -1 Error occurred. Check ufs_errno() for a code.
+ *     - UFS_ERR_NO_FILE - invalid file descriptor.
+ */
+ssize_t
+ufs_pread(int fd, char *buf, size_t size, size_t offset);
+
+/**
+ * Write data from several buffers to the file, one after another, like one
+ * ufs_write() of all of them glued together.
+ * @param fd File descriptor from ufs_open().
+ * @param iov Buffers to write.
+ * @param iovcnt Count of @a iov.
+ *
+ * @retval >= 0 How many bytes were written.
+ * @retval -1 Error occurred. Check ufs_errno() for a code.
+ *     - UFS_ERR_NO_FILE - invalid file descriptor.
+ *     - UFS_ERR_NO_MEM - not enough memory.
+ */
+ssize_t
+ufs_writev(int fd, const struct iovec *iov, int iovcnt);
+
+/**
+ * Read data from the file into several buffers, filling them one after
+ * another.
+ * @param fd File descriptor from ufs_open().
+ * @param iov Buffers to read into.
+ * @param iovcnt Count of @a iov.
+ *
+ * @retval > 0 How many bytes were read.
+ * @retval 0 EOF.
+ * @retval -1 Error occurred. Check ufs_errno() for a code.
+ *     - UFS_ERR_NO_FILE - invalid file descriptor.
+ */
+ssize_t
+ufs_readv(int fd, const struct iovec *iov, int iovcnt);
+
+/**
+ * Move the descriptor position, like lseek(). The position can be behind the
+ * file end, the next write there fills the gap with zeros.
+ * @param fd File descriptor from ufs_open().
+ * @param offset Offset from the place set by @a whence.
+ * @param whence SEEK_SET - from the file start, SEEK_CUR - from the current
+ *     position, SEEK_END - from the file end.
+ *
+ * @retval >= 0 New position.
+ * @retval -1 Error occurred. Check ufs_errno() for a code.
+ *     - UFS_ERR_NO_FILE - invalid file descriptor.
+ *     - UFS_ERR_INVALID_ARG - bad @a whence, or the new position would be
+ *       negative.
+ */
+off_t
+ufs_seek(int fd, off_t offset, int whence);
+
+/**
+ * Read data from the file without copying. Instead of the data the caller
+ * gets pointers into the file memory. They stay valid and the data under them
+ * stays unchanged until ufs_release_view(), even if the file is written,
+ * resized or deleted meanwhile. The memory must not be changed by the caller.
+ * The descriptor position moves like after ufs_read().
+ * @param fd File descriptor from ufs_open().
+ * @param size Maximum bytes to read.
+ * @param[out] iov Buffers with the data, one after another. NULL if nothing
+ *     is read.
+ * @param[out] iovcnt Count of @a iov.
+ *
+ * @retval > 0 How many bytes were read.
+ * @retval 0 EOF.
+ * @retval -1 Error occurred. Check ufs_errno() for a code.
+ *     - UFS_ERR_NO_FILE - invalid file descriptor.
+ */
+ssize_t
+ufs_read_view(int fd, size_t size, struct iovec **iov, int *iovcnt);
+
+/**
+ * Release the buffers from ufs_read_view(). They must not be used after that.
+ * @param iov Buffers from ufs_read_view().
+ * @param iovcnt Count of @a iov.
+ */
+void
+ufs_release_view(struct iovec *iov, int iovcnt);
+
 /**
  * Close a file.
  * @param fd File descriptor from ufs_open().
@@ -137,6 +251,20 @@ ufs_close(int fd);
 int
 ufs_delete(const char *filename);
 
+/**
+ * Create a copy of a file. The data is not copied: the files share it until
+ * either of them changes a part of it, so the clone of a big file is cheap.
+ * If @a dst_name exists, the file is replaced, like after ufs_delete().
+ *
+ * @param src_name Name of a file to copy.
+ * @param dst_name Name of the copy.
+ * @retval 0 Success.
+ * @retval -1 Error occurred. Check ufs_errno() for a code.
+ *     - UFS_ERR_NO_FILE - no file @a src_name.
+ */
+int
+ufs_clone(const char *src_name, const char *dst_name);
+
 #ifdef NEED_RESIZE
 
 /**
@@ -162,6 +290,32 @@ ufs_resize(int fd, size_t new_size);
 
 #endif
 
+/**
+ * Save all the files into an image file. Each file is saved consistently,
+ * as it was at some moment during the call. The deleted files which are
+ * still opened are not saved.
+ * @param path Path of the image file. Overwritten if exists.
+ * @retval 0 Success.
+ * @retval -1 Error occurred. Check ufs_errno() for a code.
+ *     - UFS_ERR_IO - the image can't be written.
+ */
+int
+ufs_snapshot(const char *path);
+
+/**
+ * Load the files from an image file made by ufs_snapshot(). The image is
+ * mapped into the memory instead of reading, so the load doesn't depend on
+ * the data size. The data is read from the image file on first access, and
+ * copied on first write. The image file itself is never changed. A loaded
+ * file replaces an existing one with the same name, like after ufs_delete().
+ * @param path Path of the image file.
+ * @retval 0 Success.
+ * @retval -1 Error occurred. Check ufs_errno() for a code.
+ *     - UFS_ERR_IO - the image can't be read or is damaged.
+ */
+int
+ufs_load(const char *path);
+
 /**
  * Destroy all the global variables, free all the memory, close and delete all
  * the files. After the destruction neither of the ufs functions are supposed to
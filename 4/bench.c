@@ -0,0 +1,163 @@
+#include "thread_pool.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+/**
+ * Throughput of the pool on empty tasks, for 1, 2, 4, ... up to the max
+ * thread count. Two ways to feed the pool:
+ *
+ * push - the main thread pushes the tasks and joins them in batches of
+ * TPOOL_MAX_TASKS. All of them go through the shared injection queue.
+ *
+ * spawn - the main thread pushes one root task per thread, and each root
+ * pushes its share of a batch from inside of the pool. They go to the deque
+ * of the root's worker and the idle workers steal them. Then the main thread
+ * joins the roots and the batch. The roots never wait, so they can't take
+ * all the workers and leave nobody to run the tasks.
+ *
+ * One line per way and thread count, in CSV:
+ *
+ *     mode,threads,tasks,tasks_per_sec
+ *
+ * $> ./bench [max thread count]
+ */
+
+enum {
+	BENCH_TASK_COUNT = 10000000,
+};
+
+static double
+now_sec(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void
+check(int rc, const char *what)
+{
+	if (rc == 0)
+		return;
+	fprintf(stderr, "%s failed, error %d\n", what, rc);
+	exit(1);
+}
+
+static void *
+task_empty_f(void *arg)
+{
+	return arg;
+}
+
+struct spawn_root {
+	struct thread_pool *pool;
+	struct thread_task **tasks;
+	int task_count;
+};
+
+static void *
+task_spawn_f(void *arg)
+{
+	struct spawn_root *root = arg;
+	for (int i = 0; i < root->task_count; ++i)
+		check(thread_pool_push_task(root->pool, root->tasks[i]), "push");
+	return NULL;
+}
+
+static void
+bench_push(int thread_count)
+{
+	struct thread_pool *pool;
+	check(thread_pool_new(thread_count, &pool), "pool new");
+	struct thread_task **tasks = malloc(sizeof(*tasks) * TPOOL_MAX_TASKS);
+	for (int i = 0; i < TPOOL_MAX_TASKS; ++i)
+		check(thread_task_new(&tasks[i], task_empty_f, NULL), "task new");
+	double start = now_sec();
+	for (int done = 0; done < BENCH_TASK_COUNT; done += TPOOL_MAX_TASKS) {
+		for (int i = 0; i < TPOOL_MAX_TASKS; ++i)
+			check(thread_pool_push_task(pool, tasks[i]), "push");
+		for (int i = 0; i < TPOOL_MAX_TASKS; ++i) {
+			void *result;
+			check(thread_task_join(tasks[i], &result), "join");
+		}
+	}
+	double duration = now_sec() - start;
+	printf("push,%d,%d,%.0f\n", thread_count, BENCH_TASK_COUNT,
+	       BENCH_TASK_COUNT / duration);
+	fflush(stdout);
+	for (int i = 0; i < TPOOL_MAX_TASKS; ++i)
+		check(thread_task_delete(tasks[i]), "task delete");
+	free(tasks);
+	check(thread_pool_delete(pool), "pool delete");
+}
+
+static void
+bench_spawn(int thread_count)
+{
+	struct thread_pool *pool;
+	check(thread_pool_new(thread_count, &pool), "pool new");
+	/* The roots are in the pool too, with their whole batch. */
+	int root_task_count = TPOOL_MAX_TASKS / thread_count - 1;
+	int batch_size = root_task_count * thread_count;
+	struct spawn_root *roots = malloc(sizeof(*roots) * thread_count);
+	struct thread_task **root_tasks =
+		malloc(sizeof(*root_tasks) * thread_count);
+	struct thread_task **tasks = malloc(sizeof(*tasks) * batch_size);
+	for (int i = 0; i < batch_size; ++i)
+		check(thread_task_new(&tasks[i], task_empty_f, NULL), "task new");
+	for (int i = 0; i < thread_count; ++i) {
+		roots[i].pool = pool;
+		roots[i].tasks = &tasks[i * root_task_count];
+		roots[i].task_count = root_task_count;
+		check(thread_task_new(&root_tasks[i], task_spawn_f, &roots[i]),
+		      "task new");
+	}
+	int task_count = 0;
+	double start = now_sec();
+	for (; task_count < BENCH_TASK_COUNT; task_count += batch_size) {
+		for (int i = 0; i < thread_count; ++i)
+			check(thread_pool_push_task(pool, root_tasks[i]), "push");
+		void *result;
+		for (int i = 0; i < thread_count; ++i)
+			check(thread_task_join(root_tasks[i], &result), "join");
+		for (int i = 0; i < batch_size; ++i)
+			check(thread_task_join(tasks[i], &result), "join");
+	}
+	double duration = now_sec() - start;
+	printf("spawn,%d,%d,%.0f\n", thread_count, task_count,
+	       task_count / duration);
+	fflush(stdout);
+	for (int i = 0; i < batch_size; ++i)
+		check(thread_task_delete(tasks[i]), "task delete");
+	for (int i = 0; i < thread_count; ++i)
+		check(thread_task_delete(root_tasks[i]), "task delete");
+	free(tasks);
+	free(root_tasks);
+	free(roots);
+	check(thread_pool_delete(pool), "pool delete");
+}
+
+int
+main(int argc, char **argv)
+{
+	int max_threads = TPOOL_MAX_THREADS;
+	if (argc > 1)
+		max_threads = atoi(argv[1]);
+	if (max_threads <= 0 || max_threads > TPOOL_MAX_THREADS) {
+		fprintf(stderr, "Usage: %s [max thread count, up to %d]\n",
+			argv[0], TPOOL_MAX_THREADS);
+		return 1;
+	}
+	printf("mode,threads,tasks,tasks_per_sec\n");
+	for (int count = 1;; count *= 2) {
+		if (count > max_threads)
+			count = max_threads;
+		bench_push(count);
+		bench_spawn(count);
+		if (count == max_threads)
+			break;
+	}
+	return 0;
+}
@@ -1,86 +1,640 @@
 #include "thread_pool.h"
+#include <errno.h>
+#include <limits.h>
 #include <pthread.h>
+#include <stdlib.h>
+#include <time.h>
+
+enum {
+	CACHE_LINE_SIZE = 64,
+	/** Initial capacity of a worker's deque. A power of 2. */
+	TASK_DEQUE_CAPACITY = 256,
+};
+
+enum task_state {
+	/** Never pushed or already joined. Can be pushed or deleted. */
+	TASK_STATE_NEW,
+	TASK_STATE_QUEUED,
+	TASK_STATE_RUNNING,
+	TASK_STATE_FINISHED,
+	TASK_STATE_JOINED,
+};
 
 struct thread_task {
 	thread_task_f function;
 	void *arg;
+	void *result;
+	enum task_state state;
+	/** Delete the task once it is finished. Protected by the lock. */
+	bool is_detached;
+	/** Protect the result and the finish of the task for join. */
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+};
 
-	/* PUT HERE OTHER MEMBERS */
+/** Ring of tasks of a deque. Replaced with a twice bigger one when full. */
+struct task_array {
+	/** A power of 2. */
+	long capacity;
+	/**
+	 * Previous array. A thief can still read from it, so it is freed only
+	 * together with the deque.
+	 */
+	struct task_array *prev;
+	struct thread_task *tasks[];
 };
 
-struct thread_pool {
-	pthread_t *threads;
+/**
+ * Chase-Lev work-stealing deque. The owner pushes and takes at the bottom
+ * without any locks or, mostly, RMW operations. The other workers steal
+ * from the top with one CAS. Only the last task is contended by the owner
+ * and the thieves.
+ */
+struct task_deque {
+	long top;
+	/** The thieves write the top, the owner - the bottom. */
+	char top_pad[CACHE_LINE_SIZE];
+	long bottom;
+	struct task_array *array;
+};
+
+struct task_queue_cell {
+	/**
+	 * Position the cell is ready for. == the position - for a push,
+	 * == the position + 1 - for a pop.
+	 */
+	size_t seq;
+	struct thread_task *task;
+};
+
+/**
+ * Bounded multi-producer multi-consumer queue, by Dmitry Vyukov. Push and
+ * pop take a position with one CAS and then wait for nobody, the cell's
+ * sequence number says whether it is ready.
+ */
+struct task_queue {
+	size_t mask;
+	struct task_queue_cell *cells;
+	/** The pops write the head, the pushes - the tail. */
+	char head_pad[CACHE_LINE_SIZE];
+	size_t head;
+	char tail_pad[CACHE_LINE_SIZE];
+	size_t tail;
+	char end_pad[CACHE_LINE_SIZE];
+};
 
-	/* PUT HERE OTHER MEMBERS */
+struct worker {
+	struct task_deque deque;
+	struct thread_pool *pool;
+	pthread_t thread;
+	/** Where to start looking for a victim to steal from. */
+	unsigned rng;
+	/** Keep the next worker's deque top away. */
+	char end_pad[CACHE_LINE_SIZE];
 };
 
+/**
+ * Each worker has its own deque. A task pushed by a worker goes to its
+ * deque, so the tasks spawning other tasks don't touch any shared state.
+ * A task pushed from outside goes to the shared injection queue. A worker
+ * runs the tasks from its deque, then from the queue, then steals from the
+ * other workers. Only a worker with nothing to do takes the pool lock to
+ * sleep.
+ */
+struct thread_pool {
+	struct worker *workers;
+	int max_thread_count;
+	int thread_count;
+	/** Pushed and not finished tasks. */
+	int task_count;
+	struct task_queue queue;
+	/** The worker of the current thread, if it is from this pool. */
+	pthread_key_t worker_key;
+	/** Protects the thread start, the sleep and the wakeup. */
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	int sleeping_count;
+	bool is_shutdown;
+};
+
+static int
+task_deque_create(struct task_deque *deque)
+{
+	struct task_array *array = malloc(sizeof(*array) +
+		sizeof(array->tasks[0]) * TASK_DEQUE_CAPACITY);
+	if (array == NULL)
+		return -1;
+	array->capacity = TASK_DEQUE_CAPACITY;
+	array->prev = NULL;
+	deque->top = 0;
+	deque->bottom = 0;
+	deque->array = array;
+	return 0;
+}
+
+static void
+task_deque_destroy(struct task_deque *deque)
+{
+	struct task_array *array = deque->array;
+	while (array != NULL) {
+		struct task_array *prev = array->prev;
+		free(array);
+		array = prev;
+	}
+}
+
+static struct task_array *
+task_deque_grow(struct task_deque *deque, struct task_array *array, long top,
+		long bottom)
+{
+	long capacity = array->capacity * 2;
+	struct task_array *new_array = malloc(sizeof(*new_array) +
+		sizeof(new_array->tasks[0]) * capacity);
+	if (new_array == NULL)
+		return NULL;
+	new_array->capacity = capacity;
+	new_array->prev = array;
+	for (long i = top; i < bottom; ++i) {
+		struct thread_task *task = __atomic_load_n(
+			&array->tasks[i & (array->capacity - 1)],
+			__ATOMIC_RELAXED);
+		__atomic_store_n(&new_array->tasks[i & (capacity - 1)], task,
+				 __ATOMIC_RELAXED);
+	}
+	__atomic_store_n(&deque->array, new_array, __ATOMIC_RELEASE);
+	return new_array;
+}
+
+/** Only by the owner. */
+static int
+task_deque_push(struct task_deque *deque, struct thread_task *task)
+{
+	long bottom = __atomic_load_n(&deque->bottom, __ATOMIC_RELAXED);
+	long top = __atomic_load_n(&deque->top, __ATOMIC_ACQUIRE);
+	struct task_array *array = __atomic_load_n(&deque->array,
+						   __ATOMIC_RELAXED);
+	if (bottom - top >= array->capacity) {
+		array = task_deque_grow(deque, array, top, bottom);
+		if (array == NULL)
+			return -1;
+	}
+	__atomic_store_n(&array->tasks[bottom & (array->capacity - 1)], task,
+			 __ATOMIC_RELAXED);
+	__atomic_store_n(&deque->bottom, bottom + 1, __ATOMIC_RELEASE);
+	return 0;
+}
+
+/** Only by the owner. The last pushed task, or NULL. */
+static struct thread_task *
+task_deque_take(struct task_deque *deque)
+{
+	long bottom = __atomic_load_n(&deque->bottom, __ATOMIC_RELAXED) - 1;
+	struct task_array *array = __atomic_load_n(&deque->array,
+						   __ATOMIC_RELAXED);
+	/*
+	 * The thieves must see the bottom moved before the owner looks at the
+	 * top, or both would take the same task.
+	 */
+	__atomic_store_n(&deque->bottom, bottom, __ATOMIC_SEQ_CST);
+	long top = __atomic_load_n(&deque->top, __ATOMIC_SEQ_CST);
+	if (top > bottom) {
+		__atomic_store_n(&deque->bottom, bottom + 1, __ATOMIC_RELAXED);
+		return NULL;
+	}
+	struct thread_task *task = __atomic_load_n(
+		&array->tasks[bottom & (array->capacity - 1)],
+		__ATOMIC_RELAXED);
+	if (top == bottom) {
+		/* The last task, race with the thieves for it. */
+		if (!__atomic_compare_exchange_n(&deque->top, &top, top + 1,
+						 false, __ATOMIC_SEQ_CST,
+						 __ATOMIC_RELAXED))
+			task = NULL;
+		__atomic_store_n(&deque->bottom, bottom + 1, __ATOMIC_RELAXED);
+	}
+	return task;
+}
+
+/**
+ * The first pushed task, or NULL. @a is_aborted is set when lost a race for
+ * a task, then the deque can still have more.
+ */
+static struct thread_task *
+task_deque_steal(struct task_deque *deque, bool *is_aborted)
+{
+	long top = __atomic_load_n(&deque->top, __ATOMIC_SEQ_CST);
+	long bottom = __atomic_load_n(&deque->bottom, __ATOMIC_SEQ_CST);
+	if (top >= bottom)
+		return NULL;
+	struct task_array *array = __atomic_load_n(&deque->array,
+						   __ATOMIC_ACQUIRE);
+	struct thread_task *task = __atomic_load_n(
+		&array->tasks[top & (array->capacity - 1)], __ATOMIC_RELAXED);
+	if (!__atomic_compare_exchange_n(&deque->top, &top, top + 1, false,
+					 __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+		*is_aborted = true;
+		return NULL;
+	}
+	return task;
+}
+
+static bool
+task_deque_is_empty(struct task_deque *deque)
+{
+	long top = __atomic_load_n(&deque->top, __ATOMIC_SEQ_CST);
+	long bottom = __atomic_load_n(&deque->bottom, __ATOMIC_SEQ_CST);
+	return top >= bottom;
+}
+
+static int
+task_queue_create(struct task_queue *queue, size_t min_capacity)
+{
+	size_t capacity = 1;
+	while (capacity < min_capacity)
+		capacity *= 2;
+	queue->cells = malloc(sizeof(queue->cells[0]) * capacity);
+	if (queue->cells == NULL)
+		return -1;
+	for (size_t i = 0; i < capacity; ++i)
+		queue->cells[i].seq = i;
+	queue->mask = capacity - 1;
+	queue->head = 0;
+	queue->tail = 0;
+	return 0;
+}
+
+static void
+task_queue_destroy(struct task_queue *queue)
+{
+	free(queue->cells);
+}
+
+static int
+task_queue_push(struct task_queue *queue, struct thread_task *task)
+{
+	size_t pos = __atomic_load_n(&queue->tail, __ATOMIC_RELAXED);
+	struct task_queue_cell *cell;
+	while (true) {
+		cell = &queue->cells[pos & queue->mask];
+		size_t seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+		long diff = (long)(seq - pos);
+		if (diff == 0) {
+			if (__atomic_compare_exchange_n(&queue->tail, &pos,
+							pos + 1, true,
+							__ATOMIC_RELAXED,
+							__ATOMIC_RELAXED))
+				break;
+		} else if (diff < 0) {
+			/* Full. */
+			return -1;
+		} else {
+			pos = __atomic_load_n(&queue->tail, __ATOMIC_RELAXED);
+		}
+	}
+	cell->task = task;
+	__atomic_store_n(&cell->seq, pos + 1, __ATOMIC_RELEASE);
+	return 0;
+}
+
+static struct thread_task *
+task_queue_pop(struct task_queue *queue)
+{
+	size_t pos = __atomic_load_n(&queue->head, __ATOMIC_RELAXED);
+	struct task_queue_cell *cell;
+	while (true) {
+		cell = &queue->cells[pos & queue->mask];
+		size_t seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+		long diff = (long)(seq - (pos + 1));
+		if (diff == 0) {
+			if (__atomic_compare_exchange_n(&queue->head, &pos,
+							pos + 1, true,
+							__ATOMIC_RELAXED,
+							__ATOMIC_RELAXED))
+				break;
+		} else if (diff < 0) {
+			/* Empty, or the push into the cell isn't done yet. */
+			return NULL;
+		} else {
+			pos = __atomic_load_n(&queue->head, __ATOMIC_RELAXED);
+		}
+	}
+	struct thread_task *task = cell->task;
+	__atomic_store_n(&cell->seq, pos + queue->mask + 1, __ATOMIC_RELEASE);
+	return task;
+}
+
+static bool
+task_queue_is_empty(struct task_queue *queue)
+{
+	size_t head = __atomic_load_n(&queue->head, __ATOMIC_SEQ_CST);
+	size_t tail = __atomic_load_n(&queue->tail, __ATOMIC_SEQ_CST);
+	return head == tail;
+}
+
+static void
+thread_task_destroy(struct thread_task *task)
+{
+	pthread_cond_destroy(&task->cond);
+	pthread_mutex_destroy(&task->lock);
+	free(task);
+}
+
+static void
+thread_task_run(struct thread_pool *pool, struct thread_task *task)
+{
+	__atomic_store_n(&task->state, TASK_STATE_RUNNING, __ATOMIC_RELAXED);
+	void *result = task->function(task->arg);
+	/* The pool can be deleted right after the join. */
+	__atomic_sub_fetch(&pool->task_count, 1, __ATOMIC_RELEASE);
+	pthread_mutex_lock(&task->lock);
+	task->result = result;
+	__atomic_store_n(&task->state, TASK_STATE_FINISHED, __ATOMIC_RELEASE);
+	bool is_detached = task->is_detached;
+	pthread_cond_signal(&task->cond);
+	pthread_mutex_unlock(&task->lock);
+	if (is_detached)
+		thread_task_destroy(task);
+}
+
+static bool
+thread_pool_has_work(struct thread_pool *pool)
+{
+	if (!task_queue_is_empty(&pool->queue))
+		return true;
+	int count = __atomic_load_n(&pool->thread_count, __ATOMIC_ACQUIRE);
+	for (int i = 0; i < count; ++i) {
+		if (!task_deque_is_empty(&pool->workers[i].deque))
+			return true;
+	}
+	return false;
+}
+
+static struct thread_task *
+worker_next_task(struct worker *worker)
+{
+	struct thread_pool *pool = worker->pool;
+	struct thread_task *task = task_deque_take(&worker->deque);
+	if (task != NULL)
+		return task;
+	task = task_queue_pop(&pool->queue);
+	if (task != NULL)
+		return task;
+	/* A just started worker can be not counted yet. */
+	int count = __atomic_load_n(&pool->thread_count, __ATOMIC_ACQUIRE);
+	if (count <= 1)
+		return NULL;
+	worker->rng = worker->rng * 1103515245 + 12345;
+	int start = (worker->rng >> 16) % count;
+	bool is_aborted;
+	do {
+		is_aborted = false;
+		for (int i = 0; i < count; ++i) {
+			struct worker *victim =
+				&pool->workers[(start + i) % count];
+			if (victim == worker)
+				continue;
+			task = task_deque_steal(&victim->deque, &is_aborted);
+			if (task != NULL)
+				return task;
+		}
+	} while (is_aborted);
+	return NULL;
+}
+
+/** Sleep until there is work. Returns false if the pool is deleted. */
+static bool
+worker_wait(struct worker *worker)
+{
+	struct thread_pool *pool = worker->pool;
+	pthread_mutex_lock(&pool->lock);
+	/*
+	 * A push makes the task visible and then looks for sleepers. Here it
+	 * is the other way around. Both look with an RMW, so one of them goes
+	 * after the other: either the push sees this worker and wakes it up,
+	 * or this worker sees the task.
+	 */
+	__atomic_add_fetch(&pool->sleeping_count, 1, __ATOMIC_SEQ_CST);
+	while (!pool->is_shutdown && !thread_pool_has_work(pool))
+		pthread_cond_wait(&pool->cond, &pool->lock);
+	__atomic_sub_fetch(&pool->sleeping_count, 1, __ATOMIC_RELAXED);
+	bool is_shutdown = pool->is_shutdown;
+	pthread_mutex_unlock(&pool->lock);
+	return !is_shutdown;
+}
+
+static void *
+worker_f(void *arg)
+{
+	struct worker *worker = arg;
+	struct thread_pool *pool = worker->pool;
+	pthread_setspecific(pool->worker_key, worker);
+	while (true) {
+		struct thread_task *task = worker_next_task(worker);
+		if (task != NULL)
+			thread_task_run(pool, task);
+		else if (!worker_wait(worker))
+			break;
+	}
+	return NULL;
+}
+
+/** Start one more thread. Under the pool lock. */
+static void
+thread_pool_start_thread(struct thread_pool *pool)
+{
+	int count = __atomic_load_n(&pool->thread_count, __ATOMIC_RELAXED);
+	struct worker *worker = &pool->workers[count];
+	if (task_deque_create(&worker->deque) != 0)
+		return;
+	worker->pool = pool;
+	worker->rng = count;
+	if (pthread_create(&worker->thread, NULL, worker_f, worker) != 0) {
+		task_deque_destroy(&worker->deque);
+		return;
+	}
+	__atomic_store_n(&pool->thread_count, count + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * Start a new thread if there are more tasks than threads, and wake up a
+ * sleeping one if any.
+ */
+static void
+thread_pool_wakeup(struct thread_pool *pool)
+{
+	/* An RMW, not a load, see worker_wait(). */
+	int sleeping_count = __atomic_fetch_add(&pool->sleeping_count, 0,
+						__ATOMIC_SEQ_CST);
+	int thread_count = __atomic_load_n(&pool->thread_count,
+					   __ATOMIC_RELAXED);
+	if (thread_count < pool->max_thread_count &&
+	    __atomic_load_n(&pool->task_count, __ATOMIC_RELAXED) >
+	    thread_count) {
+		pthread_mutex_lock(&pool->lock);
+		thread_count = __atomic_load_n(&pool->thread_count,
+					       __ATOMIC_RELAXED);
+		if (thread_count < pool->max_thread_count &&
+		    __atomic_load_n(&pool->task_count, __ATOMIC_RELAXED) >
+		    thread_count)
+			thread_pool_start_thread(pool);
+		pthread_mutex_unlock(&pool->lock);
+	}
+	if (sleeping_count > 0) {
+		pthread_mutex_lock(&pool->lock);
+		pthread_cond_signal(&pool->cond);
+		pthread_mutex_unlock(&pool->lock);
+	}
+}
+
 int
 thread_pool_new(int max_thread_count, struct thread_pool **pool)
 {
-	/* IMPLEMENT THIS FUNCTION */
-	(void)max_thread_count;
-	(void)pool;
-	return TPOOL_ERR_NOT_IMPLEMENTED;
+	if (max_thread_count <= 0 || max_thread_count > TPOOL_MAX_THREADS)
+		return TPOOL_ERR_INVALID_ARGUMENT;
+	struct thread_pool *p = calloc(1, sizeof(*p));
+	if (p == NULL)
+		abort();
+	p->workers = calloc(max_thread_count, sizeof(p->workers[0]));
+	if (p->workers == NULL)
+		abort();
+	if (task_queue_create(&p->queue, TPOOL_MAX_TASKS) != 0)
+		abort();
+	if (pthread_key_create(&p->worker_key, NULL) != 0)
+		abort();
+	p->max_thread_count = max_thread_count;
+	pthread_mutex_init(&p->lock, NULL);
+	pthread_cond_init(&p->cond, NULL);
+	*pool = p;
+	return 0;
 }
 
 int
 thread_pool_thread_count(const struct thread_pool *pool)
 {
-	/* IMPLEMENT THIS FUNCTION */
-	(void)pool;
-	return TPOOL_ERR_NOT_IMPLEMENTED;
+	return __atomic_load_n(&pool->thread_count, __ATOMIC_ACQUIRE);
 }
 
 int
 thread_pool_delete(struct thread_pool *pool)
 {
-	/* IMPLEMENT THIS FUNCTION */
-	(void)pool;
-	return TPOOL_ERR_NOT_IMPLEMENTED;
+	if (__atomic_load_n(&pool->task_count, __ATOMIC_ACQUIRE) > 0)
+		return TPOOL_ERR_HAS_TASKS;
+	pthread_mutex_lock(&pool->lock);
+	pool->is_shutdown = true;
+	pthread_cond_broadcast(&pool->cond);
+	pthread_mutex_unlock(&pool->lock);
+	int thread_count = __atomic_load_n(&pool->thread_count,
+					   __ATOMIC_ACQUIRE);
+	for (int i = 0; i < thread_count; ++i) {
+		pthread_join(pool->workers[i].thread, NULL);
+		task_deque_destroy(&pool->workers[i].deque);
+	}
+	task_queue_destroy(&pool->queue);
+	pthread_key_delete(pool->worker_key);
+	pthread_cond_destroy(&pool->cond);
+	pthread_mutex_destroy(&pool->lock);
+	free(pool->workers);
+	free(pool);
+	return 0;
 }
 
 int
 thread_pool_push_task(struct thread_pool *pool, struct thread_task *task)
 {
-	/* IMPLEMENT THIS FUNCTION */
-	(void)pool;
-	(void)task;
-	return TPOOL_ERR_NOT_IMPLEMENTED;
+	enum task_state state = __atomic_load_n(&task->state,
+						__ATOMIC_ACQUIRE);
+	if (state != TASK_STATE_NEW && state != TASK_STATE_JOINED)
+		return TPOOL_ERR_TASK_IN_POOL;
+	if (__atomic_add_fetch(&pool->task_count, 1, __ATOMIC_RELAXED) >
+	    TPOOL_MAX_TASKS) {
+		__atomic_sub_fetch(&pool->task_count, 1, __ATOMIC_RELAXED);
+		return TPOOL_ERR_TOO_MANY_TASKS;
+	}
+	task->is_detached = false;
+	__atomic_store_n(&task->state, TASK_STATE_QUEUED, __ATOMIC_RELAXED);
+	struct worker *worker = pthread_getspecific(pool->worker_key);
+	if (worker == NULL || task_deque_push(&worker->deque, task) != 0) {
+		/* Can't be full, it fits all the tasks the pool can have. */
+		if (task_queue_push(&pool->queue, task) != 0)
+			abort();
+	}
+	thread_pool_wakeup(pool);
+	return 0;
 }
 
 int
 thread_task_new(struct thread_task **task, thread_task_f function, void *arg)
 {
-	/* IMPLEMENT THIS FUNCTION */
-	(void)task;
-	(void)function;
-	(void)arg;
-	return TPOOL_ERR_NOT_IMPLEMENTED;
+	struct thread_task *t = malloc(sizeof(*t));
+	if (t == NULL)
+		abort();
+	t->function = function;
+	t->arg = arg;
+	t->result = NULL;
+	t->state = TASK_STATE_NEW;
+	t->is_detached = false;
+	pthread_mutex_init(&t->lock, NULL);
+	pthread_condattr_t attr;
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&t->cond, &attr);
+	pthread_condattr_destroy(&attr);
+	*task = t;
+	return 0;
 }
 
 bool
 thread_task_is_finished(const struct thread_task *task)
 {
-	/* IMPLEMENT THIS FUNCTION */
-	(void)task;
-	return false;
+	enum task_state state = __atomic_load_n(&task->state,
+						__ATOMIC_ACQUIRE);
+	return state == TASK_STATE_FINISHED || state == TASK_STATE_JOINED;
 }
 
 bool
 thread_task_is_running(const struct thread_task *task)
 {
-	/* IMPLEMENT THIS FUNCTION */
-	(void)task;
-	return false;
+	return __atomic_load_n(&task->state, __ATOMIC_ACQUIRE) ==
+	       TASK_STATE_RUNNING;
+}
+
+/**
+ * Wait for the task to finish until the @a deadline, or forever if it is
+ * NULL.
+ */
+static int
+thread_task_wait(struct thread_task *task, const struct timespec *deadline,
+		 void **result)
+{
+	pthread_mutex_lock(&task->lock);
+	enum task_state state = __atomic_load_n(&task->state,
+						__ATOMIC_RELAXED);
+	if (state == TASK_STATE_NEW || state == TASK_STATE_JOINED) {
+		pthread_mutex_unlock(&task->lock);
+		return TPOOL_ERR_TASK_NOT_PUSHED;
+	}
+	while (__atomic_load_n(&task->state, __ATOMIC_RELAXED) !=
+	       TASK_STATE_FINISHED) {
+		if (deadline == NULL) {
+			pthread_cond_wait(&task->cond, &task->lock);
+		} else if (pthread_cond_timedwait(&task->cond, &task->lock,
+						  deadline) == ETIMEDOUT &&
+			   __atomic_load_n(&task->state, __ATOMIC_RELAXED) !=
+			   TASK_STATE_FINISHED) {
+			pthread_mutex_unlock(&task->lock);
+			return TPOOL_ERR_TIMEOUT;
+		}
+	}
+	__atomic_store_n(&task->state, TASK_STATE_JOINED, __ATOMIC_RELEASE);
+	*result = task->result;
+	pthread_mutex_unlock(&task->lock);
+	return 0;
 }
 
 int
 thread_task_join(struct thread_task *task, void **result)
 {
-	/* IMPLEMENT THIS FUNCTION */
-	(void)task;
-	(void)result;
-	return TPOOL_ERR_NOT_IMPLEMENTED;
+	return thread_task_wait(task, NULL, result);
 }
 
 #ifdef NEED_TIMED_JOIN
@@ -88,11 +642,21 @@ thread_task_join(struct thread_task *task, void **result)
 int
 thread_task_timed_join(struct thread_task *task, double timeout, void **result)
 {
-	/* IMPLEMENT THIS FUNCTION */
-	(void)task;
-	(void)timeout;
-	(void)result;
-	return TPOOL_ERR_NOT_IMPLEMENTED;
+	/* Longer than the program can live is the same as infinity. */
+	if (timeout > INT_MAX)
+		return thread_task_wait(task, NULL, result);
+	struct timespec deadline;
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
+	if (timeout > 0) {
+		long sec = (long)timeout;
+		deadline.tv_sec += sec;
+		deadline.tv_nsec += (long)((timeout - sec) * 1000000000);
+		if (deadline.tv_nsec >= 1000000000) {
+			deadline.tv_nsec -= 1000000000;
+			++deadline.tv_sec;
+		}
+	}
+	return thread_task_wait(task, &deadline, result);
 }
 
 #endif
@@ -100,9 +664,12 @@ thread_task_timed_join(struct thread_task *task, double timeout, void **result)
 int
 thread_task_delete(struct thread_task *task)
 {
-	/* IMPLEMENT THIS FUNCTION */
-	(void)task;
-	return TPOOL_ERR_NOT_IMPLEMENTED;
+	enum task_state state = __atomic_load_n(&task->state,
+						__ATOMIC_ACQUIRE);
+	if (state != TASK_STATE_NEW && state != TASK_STATE_JOINED)
+		return TPOOL_ERR_TASK_IN_POOL;
+	thread_task_destroy(task);
+	return 0;
 }
 
 #ifdef NEED_DETACH
@@ -110,9 +677,21 @@ thread_task_delete(struct thread_task *task)
 int
 thread_task_detach(struct thread_task *task)
 {
-	/* IMPLEMENT THIS FUNCTION */
-	(void)task;
-	return TPOOL_ERR_NOT_IMPLEMENTED;
+	pthread_mutex_lock(&task->lock);
+	enum task_state state = __atomic_load_n(&task->state,
+						__ATOMIC_RELAXED);
+	if (state == TASK_STATE_NEW || state == TASK_STATE_JOINED) {
+		pthread_mutex_unlock(&task->lock);
+		return TPOOL_ERR_TASK_NOT_PUSHED;
+	}
+	if (state == TASK_STATE_FINISHED) {
+		pthread_mutex_unlock(&task->lock);
+		thread_task_destroy(task);
+		return 0;
+	}
+	task->is_detached = true;
+	pthread_mutex_unlock(&task->lock);
+	return 0;
 }
 
 #endif
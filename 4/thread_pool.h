@@ -16,6 +16,9 @@
  * used by tests.
  */
 
+#define NEED_DETACH
+#define NEED_TIMED_JOIN
+
 struct thread_pool;
 struct thread_task;
 
@@ -4,3 +4,7 @@
 
 uint64_t
 heaph_get_alloc_count(void);
+
+/** How many allocations were made since the start, freed or not. */
+uint64_t
+heaph_get_alloc_count_total(void);